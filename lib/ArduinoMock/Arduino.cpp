@@ -0,0 +1,166 @@
+// Arduino.cpp
+//
+// Simulated clock, pins and serial port of the native environment
+
+#include "Arduino.h"
+#include <stdarg.h>
+#include <map>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static uint64_t nowMicros = 0;
+static std::map<uint8_t, uint8_t> pins;
+
+namespace mock {
+  uint64_t now() {
+    return nowMicros;
+  }
+
+  void advanceMicros(uint64_t us) {
+    nowMicros += us;
+  }
+
+  void advanceMillis(uint64_t ms) {
+    nowMicros += ms * 1000;
+  }
+}
+
+// Both wrap around like on the ESP8266
+unsigned long millis() {
+  nowMicros++;
+  return (uint32_t) (nowMicros / 1000);
+}
+
+unsigned long micros() {
+  nowMicros++;
+  return (uint32_t) nowMicros;
+}
+
+void delay(unsigned long ms) {
+  mock::advanceMillis(ms);
+}
+
+void delayMicroseconds(unsigned int us) {
+  mock::advanceMicros(us);
+}
+
+void yield() {
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void) pin;
+  (void) mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  pins[pin] = value;
+}
+
+int digitalRead(uint8_t pin) {
+  return pins[pin];
+}
+
+long random(long max) {
+  return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max) {
+  return max > min ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed) {
+  srand(seed);
+}
+
+size_t Print::printf(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  return length > 0 ? write(buffer) : 0;
+}
+
+// Default of the ESP8266 core
+const size_t DEFAULT_RX_BUFFER_SIZE = 256;
+
+HardwareSerial::HardwareSerial()
+  : _device(NULL), _baud(0), _beginCount(0), _overruns(0), _reportedOverruns(0), _rxBufferSize(DEFAULT_RX_BUFFER_SIZE), _txFreeAt(0) {
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+  // Like the ESP8266 core, reinitialising the port drops pending input
+  _baud = baud;
+  _beginCount++;
+  _rx.clear();
+}
+
+void HardwareSerial::end() {
+  _baud = 0;
+}
+
+bool HardwareSerial::hasOverrun() {
+  settle();
+  bool overrun = _overruns != _reportedOverruns;
+  _reportedOverruns = _overruns;
+  return overrun;
+}
+
+void HardwareSerial::settle() {
+  if(_device) {
+    _device->update(nowMicros);
+  }
+  while(!_incoming.empty() && _incoming.front().at <= nowMicros) {
+    if(_rx.size() < _rxBufferSize) {
+      _rx.push_back(_incoming.front().c);
+    }
+    else {
+      _overruns++;
+    }
+    _incoming.pop_front();
+  }
+}
+
+int HardwareSerial::available() {
+  settle();
+  return _rx.size();
+}
+
+int HardwareSerial::read() {
+  settle();
+  if(_rx.empty()) {
+    return -1;
+  }
+  uint8_t c = _rx.front();
+  _rx.pop_front();
+  return c;
+}
+
+int HardwareSerial::peek() {
+  settle();
+  return _rx.empty() ? -1 : _rx.front();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if(!_device) {
+    _tx.push_back(c);
+    return 1;
+  }
+  // Bytes leave one after the other at the baud rate
+  uint64_t start = _txFreeAt > nowMicros ? _txFreeAt : nowMicros;
+  _txFreeAt = start + byteTime();
+  _device->receive(c, _txFreeAt);
+  return 1;
+}
+
+void HardwareSerial::inject(const uint8_t* data, size_t length) {
+  while(length--) {
+    inject(*data++, nowMicros);
+  }
+}
+
+void HardwareSerial::inject(uint8_t c, uint64_t at) {
+  TimedByte timed = { at, c };
+  _incoming.push_back(timed);
+}
@@ -0,0 +1,254 @@
+// Arduino.h
+//
+// Host replacement of the ESP8266 Arduino core for the native environment.
+// Time comes from a simulated clock that only moves when the host program
+// advances it (or when the firmware calls delay()), so runs are repeatable.
+// Serial is a mock port whose received bytes are injected by the host
+// and whose transmitted bytes are recorded.
+
+#ifndef ArduinoMock_h
+#define ArduinoMock_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <deque>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT  0x0
+#define OUTPUT 0x1
+
+#define DEC 10
+#define HEX 16
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#define constrain(value, low, high) ((value) < (low) ? (low) : ((value) > (high) ? (high) : (value)))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// Each read of the clock costs 1us of simulated time, so busy waits
+// on millis() or micros() terminate
+unsigned long millis();
+unsigned long micros();
+// Advances the simulated clock instead of sleeping
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+namespace mock {
+  // Simulated time since boot in microseconds
+  uint64_t now();
+  void advanceMicros(uint64_t us);
+  void advanceMillis(uint64_t ms);
+}
+
+class String {
+public:
+  String(const char* text = "") : _text(text ? text : "") {}
+  String(const std::string& text) : _text(text) {}
+  String(char c) : _text(1, c) {}
+  String(int value, unsigned char base = DEC) : _text(toText((long) value, base)) {}
+  String(unsigned int value, unsigned char base = DEC) : _text(toText((unsigned long) value, base)) {}
+  String(long value, unsigned char base = DEC) : _text(toText(value, base)) {}
+  String(unsigned long value, unsigned char base = DEC) : _text(toText(value, base)) {}
+  String(double value, unsigned char decimals = 2) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    _text = buffer;
+  }
+
+  const char* c_str() const { return _text.c_str(); }
+  unsigned int length() const { return _text.size(); }
+  void reserve(unsigned int size) { _text.reserve(size); }
+
+  String& operator+=(const String& other) { _text += other._text; return *this; }
+  String& operator+=(const char* other) { _text += other; return *this; }
+  String& operator+=(char c) { _text += c; return *this; }
+  bool operator==(const String& other) const { return _text == other._text; }
+  bool operator==(const char* other) const { return _text == other; }
+  bool operator!=(const String& other) const { return _text != other._text; }
+
+  friend String operator+(const String& a, const String& b) { return String(a._text + b._text); }
+  friend String operator+(const char* a, const String& b) { return String(a + b._text); }
+  friend String operator+(const String& a, const char* b) { return String(a._text + b); }
+
+private:
+  template<typename T>
+  static std::string toText(T value, unsigned char base) {
+    std::ostringstream out;
+    if(base == HEX) {
+      out << std::hex;
+    }
+    out << value;
+    return out.str();
+  }
+
+  std::string _text;
+};
+
+class IPAddress {
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) {
+    _bytes[0] = a; _bytes[1] = b; _bytes[2] = c; _bytes[3] = d;
+  }
+  String toString() const {
+    std::ostringstream out;
+    out << (int) _bytes[0] << '.' << (int) _bytes[1] << '.' << (int) _bytes[2] << '.' << (int) _bytes[3];
+    return String(out.str());
+  }
+private:
+  uint8_t _bytes[4];
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while(size--) {
+      written += write(*buffer++);
+    }
+    return written;
+  }
+  size_t write(const char* text) { return write((const uint8_t*) text, strlen(text)); }
+  virtual void flush() {}
+
+  size_t print(const char* text) { return write(text); }
+  size_t print(const String& text) { return write(text.c_str()); }
+  size_t print(const IPAddress& address) { return print(address.toString()); }
+  template<typename T>
+  size_t print(const T& value) {
+    std::ostringstream out;
+    out << value;
+    return write(out.str().c_str());
+  }
+  template<typename T>
+  size_t println(const T& value) { return print(value) + write("\r\n"); }
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+// Something plugged on the other end of a mock serial port, e.g. a simulated robot
+class SerialDevice {
+public:
+  virtual ~SerialDevice() {}
+  // A byte written by the firmware, fully transmitted at time at (us)
+  virtual void receive(uint8_t c, uint64_t at) = 0;
+  // Runs the device up to now, it answers with HardwareSerial::inject()
+  virtual void update(uint64_t now) = 0;
+};
+
+class HardwareSerial : public Stream {
+public:
+  HardwareSerial();
+
+  void begin(unsigned long baud);
+  void end();
+  // True once after received bytes were lost, like the 2.4 core
+  bool hasOverrun();
+
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t c);
+  using Print::write;
+
+  // Host side. Without a device, written bytes are recorded in output().
+  void attach(SerialDevice* device) { _device = device; }
+  // Queues bytes for the firmware, readable from time at (default now).
+  // Bytes arriving while the receive buffer is full are lost, like on the UART.
+  void inject(const uint8_t* data, size_t length);
+  void inject(uint8_t c, uint64_t at);
+  std::vector<uint8_t>& output() { return _tx; }
+
+  // Duration of one byte (start, 8 data and stop bits) at the current baud rate
+  uint64_t byteTime() const { return _baud > 0 ? 10000000ULL / _baud : 0; }
+  unsigned long baud() const { return _baud; }
+  unsigned long beginCount() const { return _beginCount; }
+  unsigned long overruns() const { return _overruns; }
+  size_t rxBufferSize() const { return _rxBufferSize; }
+
+private:
+  // Moves the bytes that arrived by now into the receive buffer
+  void settle();
+
+  struct TimedByte {
+    uint64_t at;
+    uint8_t c;
+  };
+
+  SerialDevice* _device;
+  unsigned long _baud;
+  unsigned long _beginCount;
+  unsigned long _overruns;
+  unsigned long _reportedOverruns;
+  size_t _rxBufferSize;
+  uint64_t _txFreeAt;
+  std::deque<TimedByte> _incoming;
+  std::deque<uint8_t> _rx;
+  std::vector<uint8_t> _tx;
+};
+
+extern HardwareSerial Serial;
+
+class Client : public Stream {
+public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int connect(const char* host, uint16_t port) = 0;
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int read(uint8_t* buffer, size_t size) = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+};
+
+class EspClass {
+public:
+  EspClass() : _restartRequested(false) {}
+  // Can't reboot the host, the native main loop stops instead
+  void restart() { _restartRequested = true; }
+  bool restartRequested() const { return _restartRequested; }
+  uint32_t getFreeHeap() { return 40 * 1024; }
+  uint32_t getChipId() { return 0x00c0ffee; }
+private:
+  bool _restartRequested;
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,5 @@
+// ArduinoOTA.cpp
+
+#include "ArduinoOTA.h"
+
+ArduinoOTAClass ArduinoOTA;
@@ -0,0 +1,42 @@
+// ArduinoOTA.h
+//
+// OTA updates can't happen on the host, the callbacks are only stored
+
+#ifndef ArduinoOTAMock_h
+#define ArduinoOTAMock_h
+
+#include <functional>
+
+typedef enum {
+  OTA_AUTH_ERROR,
+  OTA_BEGIN_ERROR,
+  OTA_CONNECT_ERROR,
+  OTA_RECEIVE_ERROR,
+  OTA_END_ERROR
+} ota_error_t;
+
+class ArduinoOTAClass {
+public:
+  typedef std::function<void(void)> THandlerFunction;
+  typedef std::function<void(ota_error_t)> THandlerFunction_Error;
+  typedef std::function<void(unsigned int, unsigned int)> THandlerFunction_Progress;
+
+  void setHostname(const char* hostname) { (void) hostname; }
+  void setPassword(const char* password) { (void) password; }
+  void onStart(THandlerFunction fn) { _start = fn; }
+  void onEnd(THandlerFunction fn) { _end = fn; }
+  void onProgress(THandlerFunction_Progress fn) { _progress = fn; }
+  void onError(THandlerFunction_Error fn) { _error = fn; }
+  void begin() {}
+  void handle() {}
+
+private:
+  THandlerFunction _start;
+  THandlerFunction _end;
+  THandlerFunction_Progress _progress;
+  THandlerFunction_Error _error;
+};
+
+extern ArduinoOTAClass ArduinoOTA;
+
+#endif
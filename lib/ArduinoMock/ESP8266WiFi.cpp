@@ -0,0 +1,32 @@
+// ESP8266WiFi.cpp
+
+#include "ESP8266WiFi.h"
+
+ESP8266WiFiClass WiFi;
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+  if(!connected()) {
+    return 0;
+  }
+  _tx.insert(_tx.end(), buffer, buffer + size);
+  _writes++;
+  return size;
+}
+
+int WiFiClient::read() {
+  if(_rx.empty()) {
+    return -1;
+  }
+  uint8_t c = _rx.front();
+  _rx.pop_front();
+  return c;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+  size_t count = 0;
+  while(count < size && !_rx.empty()) {
+    buffer[count++] = _rx.front();
+    _rx.pop_front();
+  }
+  return count;
+}
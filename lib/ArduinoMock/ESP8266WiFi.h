@@ -0,0 +1,76 @@
+// ESP8266WiFi.h
+//
+// Mock WiFi station and TCP client of the native environment. The
+// connection states are set by the host program.
+
+#ifndef ESP8266WiFiMock_h
+#define ESP8266WiFiMock_h
+
+#include "Arduino.h"
+
+#define WIFI_STA 1
+
+typedef enum {
+  WL_IDLE_STATUS     = 0,
+  WL_NO_SSID_AVAIL   = 1,
+  WL_CONNECTED       = 3,
+  WL_CONNECT_FAILED  = 4,
+  WL_DISCONNECTED    = 6,
+} wl_status_t;
+
+class ESP8266WiFiClass {
+public:
+  ESP8266WiFiClass() : _connected(true) {}
+
+  void mode(int mode) { (void) mode; }
+  void begin(const char* ssid, const char* password) { (void) ssid; (void) password; }
+  void reconnect() {}
+  bool setAutoReconnect(bool autoReconnect) { (void) autoReconnect; return true; }
+  void disconnect() {}
+  bool isConnected() { return _connected; }
+  wl_status_t status() { return _connected ? WL_CONNECTED : WL_DISCONNECTED; }
+  IPAddress localIP() { return IPAddress(192, 168, 0, 42); }
+
+  // Host side
+  void setConnected(bool connected) { _connected = connected; }
+
+private:
+  bool _connected;
+};
+
+extern ESP8266WiFiClass WiFi;
+
+class WiFiClient : public Client {
+public:
+  WiFiClient() : _connected(false), _noDelay(false), _writes(0) {}
+
+  int connect(IPAddress ip, uint16_t port) { (void) ip; (void) port; _connected = WiFi.isConnected(); return _connected; }
+  int connect(const char* host, uint16_t port) { (void) host; (void) port; _connected = WiFi.isConnected(); return _connected; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size);
+  int available() { return _rx.size(); }
+  int read();
+  int read(uint8_t* buffer, size_t size);
+  int peek() { return _rx.empty() ? -1 : _rx.front(); }
+  void flush() {}
+  void stop() { _connected = false; }
+  // The connection is lost with the wifi
+  uint8_t connected() { return _connected && WiFi.isConnected(); }
+  operator bool() { return connected(); }
+  void setNoDelay(bool noDelay) { _noDelay = noDelay; }
+  bool getNoDelay() { return _noDelay; }
+
+  // Host side : each write() call is counted as one TCP segment
+  void inject(const uint8_t* data, size_t length) { _rx.insert(_rx.end(), data, data + length); }
+  std::vector<uint8_t>& output() { return _tx; }
+  unsigned long writes() const { return _writes; }
+
+private:
+  bool _connected;
+  bool _noDelay;
+  unsigned long _writes;
+  std::deque<uint8_t> _rx;
+  std::vector<uint8_t> _tx;
+};
+
+#endif
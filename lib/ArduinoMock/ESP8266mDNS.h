@@ -0,0 +1,8 @@
+// ESP8266mDNS.h
+//
+// Only included for ArduinoOTA on the device, nothing to mock
+
+#ifndef ESP8266mDNSMock_h
+#define ESP8266mDNSMock_h
+
+#endif
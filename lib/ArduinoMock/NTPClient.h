@@ -0,0 +1,54 @@
+// NTPClient.h
+//
+// Like the library, an update is due every minute and a failed one is
+// tried again on every call. Each try waits for the reply with delay(10)
+// and gives up after about 1 s, so the simulated clock moves as much as
+// the ESP would be blocked. The reply only comes while the wifi is up.
+
+#ifndef NTPClientMock_h
+#define NTPClientMock_h
+
+#include "Arduino.h"
+#include "WiFiUdp.h"
+#include "ESP8266WiFi.h"
+
+class NTPClient {
+public:
+  NTPClient(WiFiUDP& udp, const char* server, long offsetSeconds)
+    : _offset(offsetSeconds), _lastUpdate(0) { (void) udp; (void) server; }
+
+  void begin() {}
+
+  bool update() {
+    if(_lastUpdate != 0 && millis() - _lastUpdate < UPDATE_INTERVAL) {
+      return false;
+    }
+    return forceUpdate();
+  }
+
+  bool forceUpdate() {
+    for(int timeout = 0; timeout <= 100; timeout++) {
+      delay(10);
+      if(WiFi.isConnected()) {
+        _lastUpdate = millis();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool isTimeSet() const { return _lastUpdate != 0; }
+
+  // Counts from 1970 until the first update, as the library does
+  unsigned long getEpochTime() const {
+    return _offset + (isTimeSet() ? 1600000000UL : 0) + millis() / 1000;
+  }
+
+private:
+  static const unsigned long UPDATE_INTERVAL = 60 * 1000;
+
+  long _offset;
+  unsigned long _lastUpdate;
+};
+
+#endif
@@ -0,0 +1,240 @@
+// PubSubClient.cpp
+
+#include "PubSubClient.h"
+
+PubSubClient::PubSubClient(Client& client)
+  : _client(&client), callback(), _buffer(MQTT_MAX_PACKET_SIZE), _state(MQTT_DISCONNECTED),
+    _brokerReachable(true), _verbose(false), _recording(true), _cleanSession(true),
+    _streamLength(0), _streamWritten(0), _streamRetained(false) {
+  // A topic always fits in a packet, beginPublish() doesn't reallocate
+  _streamTopic.reserve(MQTT_MAX_PACKET_SIZE);
+}
+
+PubSubClient& PubSubClient::setServer(const char* domain, uint16_t port) {
+  (void) domain;
+  (void) port;
+  return *this;
+}
+
+PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
+  this->callback = callback;
+  return *this;
+}
+
+bool PubSubClient::connect(const char* id) {
+  return connect(id, NULL, NULL, NULL, 0, false, NULL, true);
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass) {
+  return connect(id, user, pass, NULL, 0, false, NULL, true);
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass,
+                           const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage,
+                           bool cleanSession) {
+  (void) willQos;
+  (void) willRetain;
+  if(!_brokerReachable || !_client->connect("broker", 1883)) {
+    _state = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  // Variable header (10 bytes) and the strings of the payload
+  unsigned int length = 10 + 2 + strlen(id);
+  if(willTopic) {
+    length += 2 + strlen(willTopic) + 2 + strlen(willMessage);
+  }
+  if(user) {
+    length += 2 + strlen(user);
+  }
+  if(pass) {
+    length += 2 + strlen(pass);
+  }
+  writeHeader(0x10, length);
+  const uint8_t variableHeader[] = { 0, 4, 'M', 'Q', 'T', 'T', 4, 0, 0, 15 };
+  _client->write(variableHeader, sizeof(variableHeader));
+  writeString(id);
+  if(willTopic) {
+    writeString(willTopic);
+    writeString(willMessage);
+  }
+  if(user) {
+    writeString(user);
+  }
+  if(pass) {
+    writeString(pass);
+  }
+  _clientId = id;
+  _cleanSession = cleanSession;
+  if(cleanSession) {
+    _subscriptions.clear();
+  }
+  _state = MQTT_CONNECTED;
+  return true;
+}
+
+void PubSubClient::disconnect() {
+  const uint8_t packet[] = { 0xe0, 0 };
+  _client->write(packet, sizeof(packet));
+  _client->stop();
+  _state = MQTT_DISCONNECTED;
+}
+
+bool PubSubClient::publish(const char* topic, const char* payload) {
+  return publish(topic, (const uint8_t*) payload, payload ? strlen(payload) : 0, false);
+}
+
+bool PubSubClient::publish(const char* topic, const char* payload, bool retained) {
+  return publish(topic, (const uint8_t*) payload, payload ? strlen(payload) : 0, retained);
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int length) {
+  return publish(topic, payload, length, false);
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+  if(!connected() || 5 + 2 + strlen(topic) + length > _buffer.size()) {
+    return false;
+  }
+  // The real library builds the packet in its buffer and sends it with one write
+  size_t size = 0;
+  unsigned int remaining = 2 + strlen(topic) + length;
+  _buffer[size++] = 0x30 | (retained ? 1 : 0);
+  do {
+    uint8_t digit = remaining % 128;
+    remaining /= 128;
+    _buffer[size++] = remaining > 0 ? digit | 0x80 : digit;
+  } while(remaining > 0);
+  _buffer[size++] = strlen(topic) >> 8;
+  _buffer[size++] = strlen(topic) & 0xff;
+  memcpy(&_buffer[size], topic, strlen(topic));
+  size += strlen(topic);
+  memcpy(&_buffer[size], payload, length);
+  size += length;
+  _client->write(_buffer.data(), size);
+  record(topic, payload, length, retained);
+  return true;
+}
+
+bool PubSubClient::beginPublish(const char* topic, unsigned int length, bool retained) {
+  if(!connected()) {
+    return false;
+  }
+  writeHeader(0x30 | (retained ? 1 : 0), 2 + strlen(topic) + length);
+  writeString(topic);
+  _streamTopic = topic;
+  _streamPayload.clear();
+  _streamLength = length;
+  _streamWritten = 0;
+  _streamRetained = retained;
+  return true;
+}
+
+size_t PubSubClient::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t PubSubClient::write(const uint8_t* buffer, size_t size) {
+  if(_recording) {
+    _streamPayload.insert(_streamPayload.end(), buffer, buffer + size);
+  }
+  _streamWritten += size;
+  return _client->write(buffer, size);
+}
+
+// Like the library, always succeeds, the payload was already written
+int PubSubClient::endPublish() {
+  if(_streamWritten != _streamLength) {
+    fprintf(stderr, "PubSubClient: %s announced %u bytes, wrote %u\n",
+            _streamTopic.c_str(), _streamLength, _streamWritten);
+    return 1;
+  }
+  record(_streamTopic.c_str(), _streamPayload.data(), _streamPayload.size(), _streamRetained);
+  return 1;
+}
+
+bool PubSubClient::subscribe(const char* topic, uint8_t qos) {
+  (void) qos;
+  if(!connected()) {
+    return false;
+  }
+  _subscriptions.push_back(topic);
+  return true;
+}
+
+bool PubSubClient::unsubscribe(const char* topic) {
+  for(size_t i = 0; i < _subscriptions.size(); i++) {
+    if(_subscriptions[i] == topic) {
+      _subscriptions.erase(_subscriptions.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PubSubClient::loop() {
+  return connected();
+}
+
+bool PubSubClient::connected() {
+  if(_state == MQTT_CONNECTED && (!_brokerReachable || !_client->connected())) {
+    _client->stop();
+    _state = MQTT_CONNECTION_LOST;
+  }
+  return _state == MQTT_CONNECTED;
+}
+
+void PubSubClient::receive(const char* topic, const uint8_t* payload, unsigned int length) {
+  if(!connected() || !callback) {
+    return;
+  }
+  // The real library hands out pointers into its own receive buffer
+  std::string topicCopy(topic);
+  std::vector<uint8_t> payloadCopy(payload, payload + length);
+  callback(&topicCopy[0], payloadCopy.data(), length);
+}
+
+void PubSubClient::receive(const char* topic, const char* payload) {
+  receive(topic, (const uint8_t*) payload, strlen(payload));
+}
+
+size_t PubSubClient::writeHeader(uint8_t type, unsigned int remainingLength) {
+  uint8_t header[5];
+  size_t length = 0;
+  header[length++] = type;
+  do {
+    uint8_t digit = remainingLength % 128;
+    remainingLength /= 128;
+    header[length++] = remainingLength > 0 ? digit | 0x80 : digit;
+  } while(remainingLength > 0);
+  return _client->write(header, length);
+}
+
+size_t PubSubClient::writeString(const char* text) {
+  uint8_t length[2] = { (uint8_t) (strlen(text) >> 8), (uint8_t) (strlen(text) & 0xff) };
+  _client->write(length, 2);
+  return _client->write((const uint8_t*) text, strlen(text));
+}
+
+void PubSubClient::record(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+  if(!_recording) {
+    return;
+  }
+  Message message;
+  message.topic = topic;
+  message.payload.assign(payload, payload + length);
+  message.retained = retained;
+  message.time = millis();
+  _published.push_back(message);
+  if(!_verbose) {
+    return;
+  }
+  bool text = true;
+  for(unsigned int i = 0; i < length; i++) {
+    text &= payload[i] >= 0x20 && payload[i] < 0x7f;
+  }
+  ::printf("%10.3f %s ", millis() / 1000.0, topic);
+  for(unsigned int i = 0; i < length; i++) {
+    ::printf(text ? "%c" : "%02x", payload[i]);
+  }
+  ::printf("\n");
+}
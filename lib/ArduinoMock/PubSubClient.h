@@ -0,0 +1,105 @@
+// PubSubClient.h
+//
+// Stub of the PubSubClient MQTT client for the native environment.
+// Packets are encoded like the real library and written to the Client in
+// the same write() calls, so network usage can be measured. Received
+// messages are delivered by the host program with receive().
+// Outside of record(), which the host can turn off, nothing is allocated
+// once connected, like the real library.
+
+#ifndef PubSubClientMock_h
+#define PubSubClientMock_h
+
+#include "Arduino.h"
+#include <functional>
+
+#define MQTT_MAX_PACKET_SIZE 256
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+// Like the real one, a Print so beginPublish() payloads can be written with it
+class PubSubClient : public Print {
+public:
+  // One message published by the firmware
+  struct Message {
+    std::string topic;
+    std::vector<uint8_t> payload;
+    bool retained;
+    unsigned long time;
+  };
+
+  PubSubClient(Client& client);
+
+  PubSubClient& setServer(const char* domain, uint16_t port);
+  PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
+  PubSubClient& setBufferSize(uint16_t size) { _buffer.resize(size); return *this; }
+  uint16_t getBufferSize() { return _buffer.size(); }
+  PubSubClient& setSocketTimeout(uint16_t timeout) { (void) timeout; return *this; }
+
+  bool connect(const char* id);
+  bool connect(const char* id, const char* user, const char* pass);
+  bool connect(const char* id, const char* user, const char* pass,
+               const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage,
+               bool cleanSession = true);
+  void disconnect();
+
+  bool publish(const char* topic, const char* payload);
+  bool publish(const char* topic, const char* payload, bool retained);
+  bool publish(const char* topic, const uint8_t* payload, unsigned int length);
+  bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained);
+
+  bool beginPublish(const char* topic, unsigned int length, bool retained);
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  int endPublish();
+
+  bool subscribe(const char* topic, uint8_t qos = 0);
+  bool unsubscribe(const char* topic);
+  bool loop();
+  bool connected();
+  int state() { return _state; }
+
+  // Host side
+  void receive(const char* topic, const uint8_t* payload, unsigned int length);
+  void receive(const char* topic, const char* payload);
+  void setBrokerReachable(bool reachable) { _brokerReachable = reachable; }
+  void setVerbose(bool verbose) { _verbose = verbose; }
+  // Off, published() stays empty and publishing doesn't touch the heap
+  void setRecording(bool recording) { _recording = recording; }
+  std::vector<Message>& published() { return _published; }
+  const std::string& clientId() const { return _clientId; }
+  bool cleanSession() const { return _cleanSession; }
+  std::vector<std::string>& subscriptions() { return _subscriptions; }
+
+private:
+  size_t writeHeader(uint8_t type, unsigned int remainingLength);
+  size_t writeString(const char* text);
+  void record(const char* topic, const uint8_t* payload, unsigned int length, bool retained);
+
+  Client* _client;
+  MQTT_CALLBACK_SIGNATURE;
+  // Packet of publish(), sized by setBufferSize()
+  std::vector<uint8_t> _buffer;
+  int _state;
+  bool _brokerReachable;
+  bool _verbose;
+  bool _recording;
+  bool _cleanSession;
+  std::string _clientId;
+  std::vector<std::string> _subscriptions;
+  std::vector<Message> _published;
+  // Message started by beginPublish()
+  std::string _streamTopic;
+  std::vector<uint8_t> _streamPayload;
+  unsigned int _streamLength;
+  unsigned int _streamWritten;
+  bool _streamRetained;
+};
+
+#endif
@@ -0,0 +1,9 @@
+// WiFiUdp.h
+
+#ifndef WiFiUdpMock_h
+#define WiFiUdpMock_h
+
+class WiFiUDP {
+};
+
+#endif
@@ -9,21 +9,90 @@ Roomba::Roomba(HardwareSerial* serial, Baud baud)
 {
   _serial = serial;
   _baud = baudCodeToBaudRate(baud);
+  _begun = false;
+  _mode = ModeOff;
+  _modeKnown = false;
+  _modeSentTime = 0;
   _pollState = PollStateIdle;
+  _transactionState = TransactionIdle;
+  _transactionScript = false;
+  _transactionCallback = NULL;
+  memset(_stats, 0, sizeof(_stats));
 }
 
 // Resets the 
 void Roomba::reset()
 {
     _serial->write(7);
+    // Reboots with the OI off
+    _mode = ModeOff;
+    _modeKnown = true;
+    _modeSentTime = millis();
+}
+
+void Roomba::begin()
+{
+    _serial->begin(_baud);
+    _begun = true;
 }
 
 // Start OI
 // Changes mode to passive
 void Roomba::start()
 {
-    _serial->begin(_baud);
+    if (!_begun)
+	begin();
     _serial->write(128);
+    _mode = ModePassive;
+    _modeKnown = true;
+    _modeSentTime = millis();
+}
+
+Roomba::Mode Roomba::mode()
+{
+    return _modeKnown ? (Mode)_mode : ModeOff;
+}
+
+bool Roomba::modeKnown()
+{
+    return _modeKnown;
+}
+
+void Roomba::modeObserved(uint8_t mode)
+{
+    if (mode > ModeFull)
+	return; // Corrupted packet
+    if (millis() - _modeSentTime < ROOMBA_MODE_SETTLE_TIME)
+	return; // Sampled before our last mode command
+    _mode = mode;
+    _modeKnown = true;
+}
+
+void Roomba::invalidateMode()
+{
+    _modeKnown = false;
+}
+
+// The OI ignores every command but start() while it is off
+void Roomba::modeSent(Mode mode)
+{
+    if (_mode != ModeOff)
+	_mode = mode;
+    _modeSentTime = millis();
+}
+
+bool Roomba::ensureMode(Mode mode)
+{
+    if (_modeKnown && _mode == mode)
+	return false;
+    // Safe and Full can be entered from each other, anything else needs start() first
+    if (!_modeKnown || _mode == ModeOff || mode == ModePassive)
+	start();
+    if (mode == ModeSafe)
+	safeMode();
+    else if (mode == ModeFull)
+	fullMode();
+    return true;
 }
 
 uint32_t Roomba::baudCodeToBaudRate(Baud baud)
@@ -71,42 +140,50 @@ void Roomba::baud(Baud baud)
 void Roomba::safeMode()
 {
   _serial->write(131);
+  modeSent(ModeSafe);
 }
 
 void Roomba::fullMode()
 {
   _serial->write(132);
+  modeSent(ModeFull);
 }
 
 void Roomba::power()
 {
   _serial->write(133);
+  modeSent(ModePassive);
 }
 
 void Roomba::dock()
 {
   _serial->write(143);
+  modeSent(ModePassive);
 }
 
 void Roomba::demo(Demo demo)
 {
   _serial->write(136);
   _serial->write(demo);
+  modeSent(ModePassive);
 }
 
 void Roomba::cover()
 {
   _serial->write(135);
+  modeSent(ModePassive);
 }
 
 void Roomba::coverAndDock()
 {
   _serial->write(143);
+  modeSent(ModePassive);
 }
 
 void Roomba::spot()
 {
   _serial->write(134);
+  modeSent(ModePassive);
 }
 
 void Roomba::drive(int16_t velocity, int16_t radius)
@@ -175,6 +252,16 @@ void Roomba::song(uint8_t songNumber, const uint8_t* data, int len)
     _serial->write(data, len);
 }
 
+// Define a song from notes in flash, read a byte at a time
+void Roomba::song_P(uint8_t songNumber, const uint8_t* data, int len)
+{
+    _serial->write(140);
+    _serial->write(songNumber);
+    _serial->write(len >> 1); // 2 bytes per note
+    for (int i = 0; i < len; i++)
+        _serial->write(pgm_read_byte(data + i));
+}
+
 void Roomba::playSong(uint8_t songNumber)
 {
   _serial->write(141);
@@ -185,6 +272,7 @@ void Roomba::playSong(uint8_t songNumber)
 void Roomba::stream(const uint8_t* packetIDs, int len)
 {
   _serial->write(148);
+  _serial->write(len); // Number of packets, then their IDs
   _serial->write(packetIDs, len);
 }
 
@@ -203,6 +291,15 @@ void Roomba::script(const uint8_t* script, uint8_t len)
   _serial->write(script, len);
 }
 
+// Define a script from bytes in flash, read a byte at a time
+void Roomba::script_P(const uint8_t* script, uint8_t len)
+{
+  _serial->write(152);
+  _serial->write(len);
+  for (uint8_t i = 0; i < len; i++)
+      _serial->write(pgm_read_byte(script + i));
+}
+
 void Roomba::playScript()
 {
   _serial->write(153);
@@ -249,7 +346,8 @@ bool Roomba::getData(uint8_t* dest, uint8_t len)
     while (!_serial->available())
     {
       // Look for a timeout
-      if (millis() > startTime + ROOMBA_READ_TIMEOUT)
+      // Compare durations, not timestamps, to survive millis() wraparound
+      if (millis() - startTime > ROOMBA_READ_TIMEOUT)
         return false; // Timed out
     }
     *dest++ = _serial->read();
@@ -257,19 +355,177 @@ bool Roomba::getData(uint8_t* dest, uint8_t len)
   return true;
 }
 
+// Blocking reads are transactions waited for in place, so they 
+// also benefit from the adaptive timeouts
 bool Roomba::getSensors(uint8_t packetID, uint8_t* dest, uint8_t len)
 {
+  if (!requestSensors(packetID, dest, len))
+    return false;
+  return waitTransaction();
+}
+
+bool Roomba::getSensorsList(uint8_t* packetIDs, uint8_t numPacketIDs, uint8_t* dest, uint8_t len)
+{
+  if (!requestSensorsList(packetIDs, numPacketIDs, dest, len))
+    return false;
+  return waitTransaction();
+}
+
+void Roomba::beginTransaction(uint8_t statsIndex, uint8_t* dest, uint8_t len, TransactionCallback callback)
+{
+  // Anything received before the request can't be part of the reply
+  while (_serial->available())
+    _serial->read();
+
+  _transactionStats = statsIndex;
+  _transactionDest = dest;
+  _transactionLen = len;
+  _transactionCount = 0;
+  _transactionScript = false;
+  _transactionCallback = callback;
+  _transactionTimeout = transactionTimeout(statsIndex) * 1000UL;
+  _transactionState = TransactionPending;
+}
+
+bool Roomba::requestSensors(uint8_t packetID, uint8_t* dest, uint8_t len, TransactionCallback callback)
+{
+  if (_transactionState == TransactionPending)
+    return false;
+  beginTransaction(packetID < ROOMBA_NUM_PACKET_IDS ? packetID : ROOMBA_STATS_SENSORS_LIST,
+		   dest, len, callback);
   _serial->write(142);
   _serial->write(packetID);
-  return getData(dest, len);
+  _transactionStart = micros();
+  return true;
 }
 
-bool Roomba::getSensorsList(uint8_t* packetIDs, uint8_t numPacketIDs, uint8_t* dest, uint8_t len)
+bool Roomba::requestSensorsList(uint8_t* packetIDs, uint8_t numPacketIDs, uint8_t* dest, uint8_t len,
+				TransactionCallback callback)
 {
+  if (_transactionState == TransactionPending)
+    return false;
+  beginTransaction(ROOMBA_STATS_SENSORS_LIST, dest, len, callback);
   _serial->write(149);
   _serial->write(numPacketIDs);
   _serial->write(packetIDs, numPacketIDs);
-  return getData(dest, len);
+  _transactionStart = micros();
+  return true;
+}
+
+bool Roomba::requestScript(uint8_t* dest, uint8_t len, TransactionCallback callback)
+{
+  if (_transactionState == TransactionPending || len == 0)
+    return false;
+  beginTransaction(ROOMBA_STATS_SCRIPT, dest, len, callback);
+  _transactionScript = true;
+  // The reply length depends on the script, the latency of the last one
+  // doesn't tell how long this one takes
+  _transactionTimeout = ROOMBA_READ_TIMEOUT * 1000UL;
+  _serial->write(154);
+  _transactionStart = micros();
+  return true;
+}
+
+Roomba::TransactionState Roomba::pollTransaction()
+{
+  if (_transactionState != TransactionPending)
+  {
+      // Completion is only reported once
+      _transactionState = TransactionIdle;
+      return TransactionIdle;
+  }
+
+  TransactionStats& stats = _stats[_transactionStats];
+  while (_transactionCount < _transactionLen && _serial->available())
+  {
+      _transactionDest[_transactionCount++] = _serial->read();
+      // A script read back announces its length first
+      if (_transactionScript && _transactionCount == 1 && _transactionDest[0] + 1 < _transactionLen)
+	  _transactionLen = _transactionDest[0] + 1;
+  }
+
+  unsigned long elapsed = micros() - _transactionStart;
+  bool ok = (_transactionCount >= _transactionLen);
+  if (ok)
+  {
+      recordLatency(stats, elapsed);
+      if (stats.completed < 0xffff)
+	  stats.completed++;
+  }
+  else if (elapsed > _transactionTimeout)
+  {
+      if (stats.timeouts < 0xffff)
+	  stats.timeouts++;
+  }
+  else
+      return TransactionPending;
+
+  // Set the final state before the callback so it can start the next transaction
+  _transactionState = ok ? TransactionDone : TransactionTimeout;
+  TransactionState result = (TransactionState)_transactionState;
+  if (_transactionCallback)
+      _transactionCallback(_transactionStats, ok);
+  if (_transactionState == result)
+      _transactionState = TransactionIdle;
+  return result;
+}
+
+bool Roomba::transactionPending()
+{
+  return _transactionState == TransactionPending;
+}
+
+void Roomba::cancelTransaction()
+{
+  _transactionState = TransactionIdle;
+}
+
+bool Roomba::waitTransaction()
+{
+  TransactionState state;
+  while ((state = pollTransaction()) == TransactionPending)
+      ;
+  return state == TransactionDone;
+}
+
+const Roomba::TransactionStats& Roomba::transactionStats(uint8_t packetID)
+{
+  if (packetID > ROOMBA_STATS_SCRIPT)
+      packetID = ROOMBA_STATS_SENSORS_LIST;
+  return _stats[packetID];
+}
+
+// Same estimator as the TCP retransmission timeout: smoothed latency plus 
+// four times its mean deviation, bounded by the fixed min and max timeouts
+uint16_t Roomba::transactionTimeout(uint8_t packetID)
+{
+  const TransactionStats& stats = transactionStats(packetID);
+  if (stats.completed == 0)
+      return ROOMBA_READ_TIMEOUT; // Nothing measured yet
+  unsigned long timeout = (stats.latency + 4UL * stats.latencyVar) / 1000 + 1;
+  if (timeout < ROOMBA_MIN_READ_TIMEOUT)
+      return ROOMBA_MIN_READ_TIMEOUT;
+  if (timeout > ROOMBA_READ_TIMEOUT)
+      return ROOMBA_READ_TIMEOUT;
+  return timeout;
+}
+
+void Roomba::recordLatency(TransactionStats& stats, unsigned long latency)
+{
+  if (latency > 0xffff)
+      latency = 0xffff;
+  if (latency > stats.maxLatency)
+      stats.maxLatency = latency;
+  if (stats.completed == 0)
+  {
+      stats.latency = latency;
+      stats.latencyVar = latency / 2;
+      return;
+  }
+  // Gains of 1/8 and 1/4
+  long error = (long)latency - stats.latency;
+  stats.latency += error / 8;
+  stats.latencyVar += ((error < 0 ? -error : error) - (long)stats.latencyVar) / 4;
 }
 
 // Simple state machine to read sensor data and discard everything else
@@ -286,7 +542,9 @@ bool Roomba::pollSensors(uint8_t* dest, uint8_t len)
 		break;
 
 	    case PollStateWaitCount:
-		_pollChecksum = _pollSize = ch;
+		// The checksum covers the header byte too
+		_pollSize = ch;
+		_pollChecksum = 19 + ch;
 		_pollCount = 0;
 		_pollState = PollStateWaitBytes;
 		break;
@@ -295,7 +553,8 @@ bool Roomba::pollSensors(uint8_t* dest, uint8_t len)
 		_pollChecksum += ch;
 		if (_pollCount < len)
 		    dest[_pollCount] = ch;
-		if (_pollCount++ >= _pollSize)
+		// _pollSize data bytes follow the count, then the checksum
+		if (++_pollCount >= _pollSize)
 		    _pollState = PollStateWaitChecksum;
 		break;
 
@@ -320,7 +579,7 @@ uint8_t Roomba::getScript(uint8_t* dest, uint8_t len)
   while (!_serial->available())
   {
     // Look for a timeout
-    if (millis() > startTime + ROOMBA_READ_TIMEOUT)
+    if (millis() - startTime > ROOMBA_READ_TIMEOUT)
       return 0; // Timed out
   }
 
@@ -336,7 +595,7 @@ uint8_t Roomba::getScript(uint8_t* dest, uint8_t len)
     while (!_serial->available())
     {
       // Look for a timeout
-      if (millis() > startTime + ROOMBA_READ_TIMEOUT)
+      if (millis() - startTime > ROOMBA_READ_TIMEOUT)
         return 0; // Timed out
     }
     uint8_t data = _serial->read();
@@ -134,6 +134,28 @@
 /// If we have to wait more than this to read a char when we are expecting one, then something is wrong.
 #define ROOMBA_READ_TIMEOUT 200
 
+/// \def ROOMBA_MIN_READ_TIMEOUT
+/// Lower bound in milliseconds of the adaptive timeout of requestSensors() transactions.
+/// The Roomba only answers on its 15ms update cycle, so a timeout must cover at least one cycle.
+#define ROOMBA_MIN_READ_TIMEOUT 20
+
+/// \def ROOMBA_MODE_SETTLE_TIME
+/// Time in milliseconds after a mode command during which modeObserved() reports are ignored.
+/// Sensor data already on its way was sampled before the Roomba applied the command.
+#define ROOMBA_MODE_SETTLE_TIME 50
+
+/// \def ROOMBA_NUM_PACKET_IDS
+/// Number of sensor packet IDs (0 to 42) for which transaction statistics are kept
+#define ROOMBA_NUM_PACKET_IDS 43
+
+/// \def ROOMBA_STATS_SENSORS_LIST
+/// Index of the transaction statistics of requestSensorsList() queries
+#define ROOMBA_STATS_SENSORS_LIST ROOMBA_NUM_PACKET_IDS
+
+/// \def ROOMBA_STATS_SCRIPT
+/// Index of the transaction statistics of requestScript() read backs
+#define ROOMBA_STATS_SCRIPT (ROOMBA_NUM_PACKET_IDS + 1)
+
 // You may be able to set this so you can use Roomba with NewSoftSerial
 // instead of HardwareSerial
 //#define HardwareSerial NewSoftSerial
@@ -386,6 +408,34 @@ public:
 	SensorRightVelocity            = 41,
 	SensorLeftVelocity             = 42,
     } Sensor;
+
+    /// \enum TransactionState
+    /// Values returned by Roomba::pollTransaction()
+    typedef enum
+    {
+	TransactionIdle    = 0,
+	TransactionPending = 1,
+	TransactionDone    = 2,
+	TransactionTimeout = 3,
+    } TransactionState;
+
+    /// \struct TransactionStats
+    /// Response latency and timeout counters of the transactions for one sensor packet ID.
+    /// Latencies are measured from the end of the request to the last byte of the reply,
+    /// in microseconds, saturated at 65535.
+    typedef struct
+    {
+	uint16_t completed;     ///< Number of replies received in full
+	uint16_t timeouts;      ///< Number of transactions that timed out
+	uint16_t latency;       ///< Smoothed latency
+	uint16_t latencyVar;    ///< Smoothed mean deviation of the latency
+	uint16_t maxLatency;    ///< Largest latency seen
+    } TransactionStats;
+
+    /// Function called when a transaction started by requestSensors(), requestSensorsList() or requestScript() ends
+    /// \param[in] packetID The packet ID passed to requestSensors(), ROOMBA_STATS_SENSORS_LIST or ROOMBA_STATS_SCRIPT
+    /// \param[in] ok true if all the bytes were received, false on timeout
+    typedef void (*TransactionCallback)(uint8_t packetID, bool ok);
   
     /// Constructor. You can have multiple simultaneous Roomba if that makes sense.
     /// \param[in] serial POinter to the HardwareSerial port to use to communicate with the Roomba. 
@@ -400,8 +450,13 @@ public:
 
     /// Starts the Open Interface and sets the mode to Passive. 
     /// You must send this before sending any other commands.
-    /// Initialises the serial port to the baud rate given in the constructor
+    /// Initialises the serial port to the baud rate given in the constructor the first time it is called,
+    /// later calls only send the command so the UART and its buffered input are left alone
     void start();
+
+    /// Initialises the serial port to the baud rate given in the constructor.
+    /// Called by the first start()
+    void begin();
     
     /// Converts the specified baud code into a baud rate in bits per second
     /// \param[in] baud Baud code, one of Roomba::Baud
@@ -421,6 +476,30 @@ public:
     // for full control of the Roomba
     void fullMode();
 
+    /// Returns the OI mode the Roomba should be in, as tracked from the commands sent
+    /// and the modes reported with modeObserved()
+    /// \return One of Roomba::Mode, ModeOff until start() or when unknown
+    Mode mode();
+
+    /// Returns whether the tracked mode can be trusted.
+    /// The Roomba drops from Safe to Passive by itself on cliffs, wheel drops or when charging,
+    /// so applications should report packet 35 with modeObserved() or call invalidateMode()
+    bool modeKnown();
+
+    /// Records the mode reported by the Roomba in sensor packet 35 (SensorOIMode)
+    /// \param[in] mode The mode read, one of Roomba::Mode
+    void modeObserved(uint8_t mode);
+
+    /// Forgets the tracked mode, e.g. when the Roomba may have rebooted.
+    /// The next ensureMode() sends the whole transition
+    void invalidateMode();
+
+    /// Sends only the commands needed to get from the tracked mode to the requested one:
+    /// nothing if it is already in it, start() first when the OI is off or the mode unknown
+    /// \param[in] mode ModePassive, ModeSafe or ModeFull
+    /// \return true if any command was sent, the Roomba takes one 15 ms update to apply them
+    bool ensureMode(Mode mode);
+
     /// Puts a Roomba in sleep mode.
     /// Roomba only, no equivalent for Create.
     void power();
@@ -495,6 +574,12 @@ public:
     /// \param[in] len Length of notes array in bytes, so this will be twice the number of notes in the song
     void song(uint8_t songNumber, const uint8_t* notes, int len);
 
+    /// Same as song() but the notes array is read from flash (PROGMEM)
+    /// \param[in] songNumber Song number for this song. 0 to 15
+    /// \param[in] notes Array of note/duration pairs in PROGMEM
+    /// \param[in] len Length of notes array in bytes
+    void song_P(uint8_t songNumber, const uint8_t* notes, int len);
+
     /// Plays a song that has previously been defined by song()
     /// \param[in] songNumber The song number to play. 0 to 15
     void playSong(uint8_t songNumber);
@@ -521,6 +606,11 @@ public:
     /// \param[in] len Length of the script in bytes.
     void script(const uint8_t* script, uint8_t len);
 
+    /// Same as script() but the script is read from flash (PROGMEM)
+    /// \param[in] script Array in PROGMEM containing a sequence of Roomba OI commands.
+    /// \param[in] len Length of the script in bytes.
+    void script_P(const uint8_t* script, uint8_t len);
+
     /// Executes a previously defined script, 
     /// the last one specified by script()
     /// Create only. No equivalent on Roomba.
@@ -568,6 +658,7 @@ public:
     /// length of the sensor data. See the Open Interface manual for details on sensor packet lengths.
     /// Roomba.h defines various enums and defines for decoding sensor data.
     /// Blocks untill all len bytes are read or a read timeout occurs.
+    /// The timeout adapts to the measured latency, see requestSensors() for a non-blocking version.
     /// \param[in] packetID The ID of the sensor packet to read from Roomba::Sensor
     /// \param[out] dest Destination where the read data is stored. Must have at least len bytes available.
     /// \param[in] len Number of sensor data bytes to read
@@ -609,8 +700,79 @@ public:
     /// \return The actual number of bytes in the script, even if this is more than len. By calling 
     /// getScript(NULL, 0), you can determine how many bytes would be required to store the script.
     uint8_t getScript(uint8_t* dest, uint8_t len);
-  
+
+    /// Starts a non-blocking read of the sensor data for the specified sensor packet ID.
+    /// The reply is collected into dest by later calls to pollTransaction(), which never wait for data.
+    /// Only one transaction can be in progress at a time. Bytes already waiting on the serial port
+    /// are discarded, so this must not be mixed with a sensor stream.
+    /// \param[in] packetID The ID of the sensor packet to read from Roomba::Sensor
+    /// \param[out] dest Destination where the read data is stored. Must have at least len bytes available
+    /// and stay valid until the transaction ends.
+    /// \param[in] len Number of sensor data bytes to read
+    /// \param[in] callback Optional function called by pollTransaction() when the transaction ends
+    /// \return true if the request was sent, false if another transaction is in progress
+    bool requestSensors(uint8_t packetID, uint8_t* dest, uint8_t len, TransactionCallback callback = NULL);
+
+    /// Starts a non-blocking read of the sensor data for the specified set of sensor packet IDs.
+    /// Same as requestSensors() for a query list. Statistics are kept under ROOMBA_STATS_SENSORS_LIST.
+    /// \param[in] packetIDs Array of IDs from Roomba::Sensor of the sensors to read
+    /// \param[in] numPacketIDs number of IDs in the packetIDs array
+    /// \param[out] dest Destination where the read data is stored. Must have at least len bytes available
+    /// and stay valid until the transaction ends.
+    /// \param[in] len Number of sensor data bytes to read
+    /// \param[in] callback Optional function called by pollTransaction() when the transaction ends
+    /// \return true if the request was sent, false if another transaction is in progress
+    bool requestSensorsList(uint8_t* packetIDs, uint8_t numPacketIDs, uint8_t* dest, uint8_t len,
+			    TransactionCallback callback = NULL);
+
+    /// Starts a non-blocking read of the script most recently specified by script(), like getScript().
+    /// The reply is the length of the script followed by the script, the transaction ends after the
+    /// announced length. Statistics are kept under ROOMBA_STATS_SCRIPT.
+    /// Create only. The 500 and 600 series don't answer, the transaction times out.
+    /// \param[out] dest Destination where the length and the script are stored. Must stay valid until the
+    /// transaction ends. Scripts longer than len - 1 bytes are truncated, the rest is left on the serial port.
+    /// \param[in] len Max number of bytes to store to dest, 101 for the longest script
+    /// \param[in] callback Optional function called by pollTransaction() when the transaction ends
+    /// \return true if the request was sent, false if another transaction is in progress
+    bool requestScript(uint8_t* dest, uint8_t len, TransactionCallback callback = NULL);
+
+    /// Collects the bytes of the transaction in progress that are already available, without waiting.
+    /// The timeout of each transaction adapts to the latencies measured for its packet ID, between 
+    /// ROOMBA_MIN_READ_TIMEOUT and ROOMBA_READ_TIMEOUT.
+    /// \return TransactionPending while bytes are still expected. TransactionDone or TransactionTimeout
+    /// is returned once when the transaction ends, after the callback is called. TransactionIdle otherwise.
+    TransactionState pollTransaction();
+
+    /// \return true if a transaction is waiting for its reply
+    bool transactionPending();
+
+    /// Abandons the transaction in progress. Neither the callback nor the statistics are updated.
+    void cancelTransaction();
+
+    /// Returns the latency and timeout counters for a sensor packet ID
+    /// \param[in] packetID The sensor packet ID, ROOMBA_STATS_SENSORS_LIST or ROOMBA_STATS_SCRIPT
+    /// \return the statistics. Out of range IDs return the ROOMBA_STATS_SENSORS_LIST entry
+    const TransactionStats& transactionStats(uint8_t packetID);
+
+    /// Returns the timeout that the next transaction for a sensor packet ID will use
+    /// \param[in] packetID The sensor packet ID, or ROOMBA_STATS_SENSORS_LIST
+    /// \return timeout in milliseconds
+    uint16_t transactionTimeout(uint8_t packetID);
+
 private:
+    /// Discards stale input and resets the transaction state, before the request bytes are written
+    void beginTransaction(uint8_t statsIndex, uint8_t* dest, uint8_t len, TransactionCallback callback);
+
+    /// Blocks until the transaction in progress ends
+    /// \return true if the transaction succeeded
+    bool waitTransaction();
+
+    /// Updates the tracked mode after a command that changes it
+    void modeSent(Mode mode);
+
+    /// Updates the smoothed latency of a stats entry with a new measure
+    void recordLatency(TransactionStats& stats, unsigned long latency);
+
     /// \enum PollState
     /// Values for _pollState
     typedef enum
@@ -627,12 +789,34 @@ private:
     /// The serial port to use to talk to the Roomba
     HardwareSerial* _serial;
     
+    /// true once begin() initialised the serial port
+    bool            _begun;
+
+    /// OI mode as tracked from the commands sent, one of Roomba::Mode
+    uint8_t         _mode;
+    bool            _modeKnown;
+    unsigned long   _modeSentTime; /// millis() of the last command changing the mode
+
     /// Variables for keeping track of polling of data streams
     uint8_t         _pollState; /// Current state of polling, one of Roomba::PollState
     uint8_t         _pollSize;  /// Expected size of the data stream in bytes
     uint8_t         _pollCount; /// Num of bytes read so far
     uint8_t         _pollChecksum; /// Running checksum counter of data bytes + count
 
+    /// Variables for keeping track of the transaction in progress
+    uint8_t         _transactionState;   /// One of Roomba::TransactionState
+    uint8_t         _transactionStats;   /// Index in _stats of the transaction
+    uint8_t*        _transactionDest;    /// Where the reply is stored
+    uint8_t         _transactionLen;     /// Expected size of the reply in bytes
+    uint8_t         _transactionCount;   /// Num of bytes read so far
+    bool            _transactionScript;  /// The first byte of the reply gives its length
+    unsigned long   _transactionStart;   /// micros() when the request was sent
+    unsigned long   _transactionTimeout; /// Timeout of the transaction in microseconds
+    TransactionCallback _transactionCallback;
+
+    /// Per packet ID latency and timeout counters, plus one entry for query lists
+    TransactionStats _stats[ROOMBA_STATS_SCRIPT + 1];
+
 };
 
 /// @example RoombaRCRxESP8266/RoombaRCRxESP8266.ino
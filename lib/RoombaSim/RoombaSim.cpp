@@ -0,0 +1,646 @@
+// RoombaSim.cpp
+
+#include "RoombaSim.h"
+
+// Distance between the wheels in mm
+static const double WHEEL_BASE = 235.0;
+static const double PI_VALUE = 3.14159265358979323846;
+
+static int16_t readInt16(const uint8_t* data) {
+  return (int16_t) ((data[0] << 8) | data[1]);
+}
+
+static int writeInt16(uint8_t* dest, int value) {
+  dest[0] = (value >> 8) & 0xff;
+  dest[1] = value & 0xff;
+  return 2;
+}
+
+static double randomUnit() {
+  return rand() / (double) RAND_MAX;
+}
+
+RoombaSim::RoombaSim(HardwareSerial& serial)
+  : _serial(serial), _mode(ModeOff), _activity(ActivityIdle),
+    _commandLength(0), _commandExpected(0), _commandVariableAdded(false),
+    _nextTick(0), _txFreeAt(0),
+    _requestedVelocity(0), _requestedRadius(0), _leftVelocity(0), _rightVelocity(0),
+    _x(0), _y(0), _heading(0), _distanceAccumulator(0), _angleAccumulator(0), _turnRemaining(0),
+    _nextBump(0), _bumps(0), _activityStart(0),
+    _charge(2000), _capacity(2700), _current(-150), _voltage(15000), _chargingState(0),
+    _chargingMessages(false), _nextChargingMessage(0), _bogusBatteryRate(0), _corruptionRate(0),
+    _songPlaying(0), _songNumber(0), _songEnd(0),
+    _streamCount(0), _streamPaused(false),
+    _scriptLength(0), _scriptPosition(-1), _scriptWaitUntil(0), _scriptWaitDistance(0), _scriptWaitAngle(0),
+    _scriptWaitEvent(0), _scriptWaiting(false), _scripts(true) {
+  memset(&_stats, 0, sizeof(_stats));
+  memset(_songs, 0, sizeof(_songs));
+  memset(_leds, 0, sizeof(_leds));
+  _serial.attach(this);
+}
+
+void RoombaSim::setBattery(uint16_t charge, uint16_t capacity) {
+  _charge = charge;
+  _capacity = capacity;
+}
+
+void RoombaSim::dock() {
+  stopMotion();
+  _activity = ActivityDocked;
+}
+
+void RoombaSim::receive(uint8_t c, uint64_t at) {
+  PendingByte pending = { at, c };
+  _received.push_back(pending);
+}
+
+// Bytes and ticks are processed in time order
+void RoombaSim::update(uint64_t now) {
+  for(;;) {
+    bool haveByte = !_received.empty() && _received.front().at <= now;
+    bool haveTick = _nextTick <= now;
+    if(!haveByte && !haveTick) {
+      return;
+    }
+    if(haveByte && (!haveTick || _received.front().at <= _nextTick)) {
+      feed(_received.front().c, _received.front().at);
+      _received.pop_front();
+    }
+    else {
+      tick(_nextTick);
+      _nextTick += TICK_US;
+    }
+  }
+}
+
+void RoombaSim::feed(uint8_t c, uint64_t at) {
+  _stats.bytesReceived++;
+  if(_commandLength == 0) {
+    int arguments = _scripts || c < 152 || c > 158 ? argumentCount(c) : -1;
+    if(arguments < 0) {
+      _stats.unknownOpcodes++;
+      return;
+    }
+    _commandExpected = 1 + arguments;
+    _commandVariableAdded = false;
+  }
+  _command[_commandLength++] = c;
+  if(_commandLength == _commandExpected && !_commandVariableAdded) {
+    _commandExpected += variableCount(_command, _commandLength);
+    _commandVariableAdded = true;
+  }
+  if(_commandLength >= _commandExpected) {
+    PendingCommand command;
+    command.at = at;
+    command.bytes.assign(_command, _command + _commandLength);
+    _commands.push_back(command);
+    _commandLength = 0;
+  }
+}
+
+int RoombaSim::argumentCount(uint8_t opcode) {
+  switch(opcode) {
+    case 7:   // Reset
+    case 128: // Start
+    case 130: // Control
+    case 131: // Safe
+    case 132: // Full
+    case 133: // Power
+    case 134: // Spot
+    case 135: // Clean
+    case 136: // Max clean
+    case 143: // Dock
+    case 153: // Play script
+    case 154: // Show script
+      return 0;
+    case 129: // Baud
+    case 138: // Motors
+    case 141: // Play song
+    case 142: // Sensors
+    case 147: // Digital outputs
+    case 148: // Stream, number of packets
+    case 149: // Query list, number of packets
+    case 150: // Pause/resume stream
+    case 151: // Send IR
+    case 152: // Script, length
+    case 155: // Wait time
+    case 158: // Wait event
+      return 1;
+    case 140: // Song, number and length
+    case 156: // Wait distance
+    case 157: // Wait angle
+      return 2;
+    case 139: // LEDs
+    case 144: // PWM motors
+      return 3;
+    case 137: // Drive
+    case 145: // Drive direct
+    case 146: // Drive PWM
+      return 4;
+    default:
+      return -1;
+  }
+}
+
+int RoombaSim::variableCount(const uint8_t* command, uint8_t fixedLength) {
+  switch(command[0]) {
+    case 140:
+      return 2 * command[2];
+    case 148:
+    case 149:
+    case 152:
+      return command[1];
+    default:
+      (void) fixedLength;
+      return 0;
+  }
+}
+
+bool RoombaSim::allowed(uint8_t opcode) const {
+  if(_mode == ModeOff) {
+    return opcode == 128 || opcode == 7;
+  }
+  if(_mode == ModePassive) {
+    switch(opcode) {
+      case 137: case 138: case 139: case 141: case 144:
+      case 145: case 146: case 147: case 151:
+        return false; // Actuators need Safe or Full mode
+    }
+  }
+  return true;
+}
+
+void RoombaSim::reboot(uint64_t now) {
+  setMode(ModeOff);
+  _streamCount = 0;
+  stopMotion();
+  memset(_songs, 0, sizeof(_songs));
+  _scriptLength = 0;
+  _scriptPosition = -1;
+  sendText("bl-start\r\n2006-09-12-1137-L   \r\nRDK by iRobot!\r\n", now);
+}
+
+void RoombaSim::setMode(Mode mode) {
+  if(mode != _mode) {
+    _stats.modeChanges++;
+  }
+  _mode = mode;
+}
+
+void RoombaSim::stopMotion() {
+  _leftVelocity = _rightVelocity = 0;
+  _requestedVelocity = _requestedRadius = 0;
+  _turnRemaining = 0;
+}
+
+void RoombaSim::tick(uint64_t now) {
+  while(!_commands.empty() && _commands.front().at <= now) {
+    PendingCommand& command = _commands.front();
+    execute(command.bytes.data(), command.bytes.size(), now);
+    _commands.pop_front();
+  }
+  runScript(now);
+  physics(TICK_US / 1e6, now);
+
+  if(_songPlaying && now >= _songEnd) {
+    _songPlaying = 0;
+  }
+
+  if(_chargingMessages && _activity == ActivityDocked && now >= _nextChargingMessage) {
+    char text[96];
+    snprintf(text, sizeof(text), "bat:   min %d  sec %d  mV %u  mA %d  deg-C 24  \r\n",
+             (int) (now / 60000000ULL), (int) (now / 1000000ULL % 60), _voltage, _current);
+    sendText(text, now);
+    _nextChargingMessage = now + 1000000ULL;
+  }
+
+  if(_streamCount > 0 && !_streamPaused && _mode != ModeOff) {
+    if(_txFreeAt > now) {
+      // The robot doesn't queue frames, it skips the ones it has no time to send
+      _stats.skippedFrames++;
+      return;
+    }
+    uint8_t frame[256];
+    int length = 2;
+    for(uint8_t i = 0; i < _streamCount && length < 200; i++) {
+      frame[length++] = _streamPackets[i];
+      length += encodePacket(_streamPackets[i], frame + length);
+    }
+    frame[0] = 19;
+    frame[1] = length - 2;
+    uint8_t sum = 0;
+    for(int i = 0; i < length; i++) {
+      sum += frame[i];
+    }
+    frame[length++] = (uint8_t) (0x100 - sum);
+    send(frame, length, now, now);
+    _stats.streamFrames++;
+  }
+}
+
+void RoombaSim::execute(const uint8_t* command, uint8_t length, uint64_t now) {
+  uint8_t opcode = command[0];
+  if(!allowed(opcode)) {
+    _stats.ignoredCommands++;
+    return;
+  }
+  _stats.commands++;
+  uint8_t reply[256];
+  int replyLength = 0;
+
+  switch(opcode) {
+    case 7:
+      reboot(now);
+      break;
+    case 128:
+      setMode(ModePassive);
+      break;
+    case 130:
+    case 131:
+      setMode(ModeSafe);
+      break;
+    case 132:
+      setMode(ModeFull);
+      break;
+    case 133:
+      stopMotion();
+      if(_activity != ActivityDocked) {
+        _activity = ActivityIdle;
+      }
+      setMode(ModePassive);
+      break;
+    case 134:
+    case 135:
+    case 136:
+      _activity = ActivityCleaning;
+      _activityStart = now;
+      _nextBump = now + 2000000ULL;
+      setMode(ModePassive);
+      break;
+    case 137: {
+      _activity = ActivityIdle;
+      int velocity = _requestedVelocity = readInt16(command + 1);
+      int radius = _requestedRadius = readInt16(command + 3);
+      if(radius == -32768 || radius == 32767) {
+        _leftVelocity = _rightVelocity = velocity;
+      }
+      else if(radius == -1) {
+        _leftVelocity = velocity;
+        _rightVelocity = -velocity;
+      }
+      else if(radius == 1) {
+        _leftVelocity = -velocity;
+        _rightVelocity = velocity;
+      }
+      else if(radius != 0) {
+        _leftVelocity = velocity * (radius - WHEEL_BASE / 2) / radius;
+        _rightVelocity = velocity * (radius + WHEEL_BASE / 2) / radius;
+      }
+      else {
+        // drive(0, 0) is the usual way to stop
+        _leftVelocity = _rightVelocity = velocity;
+      }
+      break;
+    }
+    case 139:
+      memcpy(_leds, command + 1, 3);
+      break;
+    case 140:
+      if(command[1] < 16 && command[2] <= 16) {
+        memcpy(_songs[command[1]], command + 2, 1 + 2 * command[2]);
+      }
+      break;
+    case 141:
+      if(command[1] < 16 && _songs[command[1]][0] > 0) {
+        unsigned long ticks64 = 0;
+        for(uint8_t i = 0; i < _songs[command[1]][0]; i++) {
+          ticks64 += _songs[command[1]][2 + 2 * i];
+        }
+        _songNumber = command[1];
+        _songPlaying = 1;
+        _songEnd = now + ticks64 * 1000000ULL / 64;
+      }
+      break;
+    case 142:
+      _stats.queries++;
+      replyLength = encodePacket(command[1], reply);
+      break;
+    case 143:
+      _activity = ActivitySeekingDock;
+      _activityStart = now;
+      _nextBump = now + 3000000ULL;
+      setMode(ModePassive);
+      break;
+    case 145:
+      _activity = ActivityIdle;
+      _rightVelocity = readInt16(command + 1);
+      _leftVelocity = readInt16(command + 3);
+      break;
+    case 148:
+      _streamCount = command[1] < sizeof(_streamPackets) ? command[1] : sizeof(_streamPackets);
+      memcpy(_streamPackets, command + 2, _streamCount);
+      _streamPaused = false;
+      break;
+    case 149:
+      _stats.queries++;
+      for(uint8_t i = 0; i < command[1] && replyLength < 200; i++) {
+        replyLength += encodePacket(command[2 + i], reply + replyLength);
+      }
+      break;
+    case 150:
+      _streamPaused = command[1] == 0;
+      break;
+    case 152:
+      _scriptLength = command[1] <= 100 ? command[1] : 100;
+      memcpy(_script, command + 2, _scriptLength);
+      _scriptPosition = -1;
+      break;
+    case 153:
+      _scriptPosition = 0;
+      _scriptWaiting = false;
+      break;
+    case 154:
+      reply[0] = _scriptLength;
+      memcpy(reply + 1, _script, _scriptLength);
+      replyLength = 1 + _scriptLength;
+      break;
+    default:
+      // Baud, motors, PWM, outputs, IR : accepted and ignored.
+      // Waits only mean something inside a script.
+      break;
+  }
+  (void) length;
+  if(replyLength > 0) {
+    send(reply, replyLength, now, now);
+  }
+}
+
+void RoombaSim::runScript(uint64_t now) {
+  if(_scriptPosition < 0) {
+    return;
+  }
+  if(_scriptWaiting) {
+    bool done = now >= _scriptWaitUntil && _scriptWaitDistance <= 0 && _scriptWaitAngle <= 0;
+    if(_scriptWaitEvent == 5) {
+      done = done && _bumps != 0;
+    }
+    if(!done) {
+      return;
+    }
+    _scriptWaiting = false;
+  }
+  while(_scriptPosition < _scriptLength) {
+    const uint8_t* command = _script + _scriptPosition;
+    int arguments = argumentCount(command[0]);
+    if(arguments < 0) {
+      _scriptPosition = -1;
+      return;
+    }
+    int length = 1 + arguments + variableCount(command, 1 + arguments);
+    if(_scriptPosition + length > _scriptLength) {
+      break;
+    }
+    _scriptPosition += length;
+    switch(command[0]) {
+      case 155: // Tenths of a second
+        _scriptWaitUntil = now + command[1] * 100000ULL;
+        _scriptWaitDistance = _scriptWaitAngle = 0;
+        _scriptWaitEvent = 0;
+        _scriptWaiting = true;
+        return;
+      case 156:
+        _scriptWaitUntil = 0;
+        _scriptWaitDistance = abs(readInt16(command + 1));
+        _scriptWaitAngle = 0;
+        _scriptWaitEvent = 0;
+        _scriptWaiting = true;
+        return;
+      case 157:
+        _scriptWaitUntil = 0;
+        _scriptWaitDistance = 0;
+        _scriptWaitAngle = abs(readInt16(command + 1));
+        _scriptWaitEvent = 0;
+        _scriptWaiting = true;
+        return;
+      case 158:
+        _scriptWaitUntil = 0;
+        _scriptWaitDistance = _scriptWaitAngle = 0;
+        _scriptWaitEvent = command[1];
+        _scriptWaiting = true;
+        return;
+      case 153:
+      case 154:
+        break; // Not allowed inside a script
+      default:
+        execute(command, length, now);
+        break;
+    }
+  }
+  _scriptPosition = -1;
+}
+
+void RoombaSim::physics(double dt, uint64_t now) {
+  _bumps = 0;
+  bool brushes = false;
+
+  if(_activity == ActivityCleaning || _activity == ActivitySeekingDock) {
+    brushes = _activity == ActivityCleaning;
+    if(now >= _nextBump) {
+      _bumps = randomUnit() < 0.5 ? 0x1 : 0x2;
+      _turnRemaining = 60 + randomUnit() * 120;
+      _nextBump = now + (uint64_t) ((2 + randomUnit() * 6) * 1000000);
+    }
+    if(_turnRemaining > 0) {
+      _leftVelocity = 150;
+      _rightVelocity = -150;
+    }
+    else {
+      _leftVelocity = _rightVelocity = _activity == ActivityCleaning ? 250 : 200;
+    }
+    if(_activity == ActivitySeekingDock && now - _activityStart > 20000000ULL) {
+      dock();
+    }
+  }
+  else if(_activity == ActivityDocked) {
+    _leftVelocity = _rightVelocity = 0;
+  }
+
+  double distance = (_leftVelocity + _rightVelocity) / 2.0 * dt;
+  double angle = (_rightVelocity - _leftVelocity) / WHEEL_BASE * dt * 180 / PI_VALUE;
+  _x += distance * cos(_heading * PI_VALUE / 180);
+  _y += distance * sin(_heading * PI_VALUE / 180);
+  _heading += angle;
+  _distanceAccumulator += distance;
+  _angleAccumulator += angle;
+  if(_turnRemaining > 0) {
+    _turnRemaining -= fabs(angle);
+  }
+  if(_scriptWaiting) {
+    _scriptWaitDistance -= fabs(distance);
+    _scriptWaitAngle -= fabs(angle);
+  }
+
+  // Battery : quiescent draw, motors and brushes when not on the dock
+  if(_activity == ActivityDocked) {
+    bool full = _charge >= _capacity * 0.98;
+    _current = full ? 60 : 1500;
+    _chargingState = full ? 3 : 2;
+  }
+  else {
+    double current = 150 + (abs(_leftVelocity) + abs(_rightVelocity)) * 1.5;
+    if(brushes) {
+      current += 900;
+    }
+    if(_bumps) {
+      current += 2500; // Motor inrush when reversing
+    }
+    current += (randomUnit() - 0.5) * 100;
+    _current = (int16_t) -current;
+    _chargingState = 0;
+  }
+  _charge += _current * dt / 3600;
+  if(_charge < 0) {
+    _charge = 0;
+  }
+  if(_charge > _capacity) {
+    _charge = _capacity;
+  }
+  _voltage = (uint16_t) (13000 + 3500 * _charge / _capacity + _current * 0.2);
+}
+
+int RoombaSim::packetLength(uint8_t packetID) {
+  switch(packetID) {
+    case 0: return 26;
+    case 1: return 10;
+    case 2: return 6;
+    case 3: return 10;
+    case 4: return 14;
+    case 5: return 12;
+    case 6: return 52;
+    case 19: case 20: case 22: case 23: case 25: case 26:
+    case 27: case 28: case 29: case 30: case 31: case 33:
+    case 39: case 40: case 41: case 42:
+      return 2;
+    default:
+      return packetID <= 42 ? 1 : 0;
+  }
+}
+
+int RoombaSim::encodePacket(uint8_t packetID, uint8_t* dest) {
+  static const uint8_t groupFirst[] = { 7, 7, 17, 21, 27, 35, 7 };
+  static const uint8_t groupLast[] = { 26, 16, 20, 26, 34, 42, 42 };
+  if(packetID > 6) {
+    return encodeValue(packetID, dest);
+  }
+  int length = 0;
+  for(uint8_t id = groupFirst[packetID]; id <= groupLast[packetID]; id++) {
+    length += encodeValue(id, dest + length);
+  }
+  return length;
+}
+
+int RoombaSim::encodeValue(uint8_t packetID, uint8_t* dest) {
+  int length = packetLength(packetID);
+  memset(dest, 0, length);
+  switch(packetID) {
+    case 7:
+      dest[0] = _bumps;
+      break;
+    case 19: {
+      // Reading the distance and angle resets them
+      int distance = (int) _distanceAccumulator;
+      _distanceAccumulator -= distance;
+      writeInt16(dest, distance);
+      break;
+    }
+    case 20: {
+      int angle = (int) _angleAccumulator;
+      _angleAccumulator -= angle;
+      writeInt16(dest, angle);
+      break;
+    }
+    case 21:
+      dest[0] = _chargingState;
+      break;
+    case 22:
+      writeInt16(dest, _voltage);
+      break;
+    case 23:
+      writeInt16(dest, _current);
+      break;
+    case 24:
+      dest[0] = 24;
+      break;
+    case 25:
+      writeInt16(dest, randomUnit() < _bogusBatteryRate ? 65535 : (int) _charge);
+      break;
+    case 26:
+      writeInt16(dest, randomUnit() < _bogusBatteryRate ? 65535 : _capacity);
+      break;
+    case 34:
+      dest[0] = _activity == ActivityDocked ? 0x2 : 0;
+      break;
+    case 35:
+      dest[0] = _mode;
+      break;
+    case 36:
+      dest[0] = _songNumber;
+      break;
+    case 37:
+      dest[0] = _songPlaying;
+      break;
+    case 38:
+      dest[0] = _streamCount;
+      break;
+    case 39:
+      writeInt16(dest, _requestedVelocity);
+      break;
+    case 40:
+      writeInt16(dest, _requestedRadius);
+      break;
+    case 41:
+      writeInt16(dest, _rightVelocity);
+      break;
+    case 42:
+      writeInt16(dest, _leftVelocity);
+      break;
+  }
+  return length;
+}
+
+void RoombaSim::send(const uint8_t* data, size_t length, uint64_t at, uint64_t sampledAt) {
+  for(size_t i = 0; i < length; i++) {
+    uint64_t start = _txFreeAt > at ? _txFreeAt : at;
+    _txFreeAt = start + _serial.byteTime();
+    uint8_t c = data[i];
+    if(_corruptionRate > 0 && randomUnit() < _corruptionRate) {
+      c ^= 1 << (rand() % 8);
+    }
+    _serial.inject(c, _txFreeAt);
+    _stats.bytesSent++;
+  }
+  _deliveries.push_back(std::make_pair(_txFreeAt, sampledAt));
+  if(_deliveries.size() > 16) {
+    _deliveries.pop_front();
+  }
+}
+
+void RoombaSim::sendText(const char* text, uint64_t at) {
+  size_t length = strlen(text);
+  for(size_t i = 0; i < length; i++) {
+    uint64_t start = _txFreeAt > at ? _txFreeAt : at;
+    _txFreeAt = start + _serial.byteTime();
+    _serial.inject((uint8_t) text[i], _txFreeAt);
+    _stats.bytesSent++;
+  }
+}
+
+uint64_t RoombaSim::freshestDelivered(uint64_t now) const {
+  uint64_t freshest = 0;
+  for(size_t i = 0; i < _deliveries.size(); i++) {
+    if(_deliveries[i].first <= now && _deliveries[i].second > freshest) {
+      freshest = _deliveries[i].second;
+    }
+  }
+  return freshest;
+}
@@ -0,0 +1,199 @@
+// RoombaSim.h
+//
+// Simulated Roomba plugged behind a mock HardwareSerial.
+// It decodes the Open Interface commands written by the Roomba class
+// (opcodes 128 to 158), answers sensor queries (142, 149, 154) and sends
+// sensor streams (148) with correct checksums.
+//
+// Timing follows the real robot : bytes travel at the baud rate in both
+// directions, and the robot works on a 15 ms update tick. Commands take
+// effect and queries are answered on the tick following the last byte of
+// the command, stream frames are sent at the start of each tick and are
+// skipped when the previous one is still being transmitted.
+//
+// The physics is deliberately simple : differential drive odometry,
+// random bumps while cleaning, docking after a while when seeking the
+// dock, and a battery charged or drained by the current.
+
+#ifndef RoombaSim_h
+#define RoombaSim_h
+
+#include <Arduino.h>
+
+class RoombaSim : public SerialDevice {
+public:
+  /// Update tick of the robot in microseconds
+  static const uint64_t TICK_US = 15000;
+
+  /// Values of sensor packet 35
+  typedef enum {
+    ModeOff     = 0,
+    ModePassive = 1,
+    ModeSafe    = 2,
+    ModeFull    = 3,
+  } Mode;
+
+  /// What the robot is doing on its own
+  typedef enum {
+    ActivityIdle,
+    ActivityCleaning,
+    ActivitySeekingDock,
+    ActivityDocked,
+  } Activity;
+
+  /// Counters of what went through the serial port
+  struct Stats {
+    unsigned long bytesReceived;
+    unsigned long bytesSent;
+    unsigned long commands;
+    unsigned long ignoredCommands;   ///< Not allowed in the current mode
+    unsigned long unknownOpcodes;
+    unsigned long queries;           ///< 142 and 149
+    unsigned long streamFrames;
+    unsigned long skippedFrames;     ///< Previous frame still being sent
+    unsigned long modeChanges;
+  };
+
+  RoombaSim(HardwareSerial& serial);
+
+  void receive(uint8_t c, uint64_t at);
+  void update(uint64_t now);
+
+  /// Sets the battery state, charge and capacity in mAh
+  void setBattery(uint16_t charge, uint16_t capacity);
+
+  /// Places the robot on its dock, where it charges
+  void dock();
+
+  /// Reboots like the reset command or a battery swap : the OI is off and
+  /// the songs and script are lost
+  void reboot(uint64_t now);
+
+  /// Sends the "bat:" text lines a charging robot prints every second
+  void setChargingMessages(bool enabled) { _chargingMessages = enabled; }
+
+  /// Probability for each sent byte to be corrupted, to exercise resynchronisation
+  void setCorruptionRate(double rate) { _corruptionRate = rate; }
+
+  /// Answer large battery values like some firmwares do (capacity or charge of 65535)
+  void setBogusBatteryRate(double rate) { _bogusBatteryRate = rate; }
+
+  /// false models the OI of the 500 and 600 series, which has no script
+  /// commands : 152 to 158 are unknown opcodes and their bytes are taken
+  /// for the next commands
+  void setScripts(bool enabled) { _scripts = enabled; }
+
+  Mode mode() const { return _mode; }
+  Activity activity() const { return _activity; }
+  const Stats& stats() const { return _stats; }
+
+  /// Position in mm and heading in degrees since the simulation started
+  double x() const { return _x; }
+  double y() const { return _y; }
+  double heading() const { return _heading; }
+
+  /// Time at which the robot sampled the freshest sensor data that was
+  /// completely received by the firmware at time now, 0 if none yet
+  uint64_t freshestDelivered(uint64_t now) const;
+
+private:
+  void tick(uint64_t now);
+  void execute(const uint8_t* command, uint8_t length, uint64_t now);
+  bool allowed(uint8_t opcode) const;
+  void setMode(Mode mode);
+  void stopMotion();
+  void physics(double dt, uint64_t now);
+  void runScript(uint64_t now);
+
+  // Number of argument bytes of an opcode, -1 if unknown. Commands with
+  // a variable length return the length of their fixed part.
+  static int argumentCount(uint8_t opcode);
+  // Extra bytes announced in the fixed part (songs, streams, scripts...)
+  static int variableCount(const uint8_t* command, uint8_t fixedLength);
+
+  static int packetLength(uint8_t packetID);
+  int encodePacket(uint8_t packetID, uint8_t* dest);
+  int encodeValue(uint8_t packetID, uint8_t* dest);
+
+  void send(const uint8_t* data, size_t length, uint64_t at, uint64_t sampledAt);
+  void sendText(const char* text, uint64_t at);
+
+  HardwareSerial& _serial;
+  Stats _stats;
+  Mode _mode;
+  Activity _activity;
+
+  // Command being received
+  struct PendingByte {
+    uint64_t at;
+    uint8_t c;
+  };
+  std::deque<PendingByte> _received;
+  void feed(uint8_t c, uint64_t at);
+  uint8_t _command[256];
+  int _commandLength;
+  int _commandExpected;
+  bool _commandVariableAdded;
+  // Commands complete at a time, executed at the next tick
+  struct PendingCommand {
+    uint64_t at;
+    std::vector<uint8_t> bytes;
+  };
+  std::deque<PendingCommand> _commands;
+
+  uint64_t _nextTick;
+  uint64_t _txFreeAt;
+  // When each reply or frame finished arriving, and when it was sampled
+  std::deque<std::pair<uint64_t, uint64_t> > _deliveries;
+
+  // Motion
+  int16_t _requestedVelocity;
+  int16_t _requestedRadius;
+  int16_t _leftVelocity;
+  int16_t _rightVelocity;
+  double _x;
+  double _y;
+  double _heading;
+  double _distanceAccumulator;
+  double _angleAccumulator;
+  double _turnRemaining;
+  uint64_t _nextBump;
+  uint8_t _bumps;
+  uint64_t _activityStart;
+
+  // Battery, in mAh and mA
+  double _charge;
+  uint16_t _capacity;
+  int16_t _current;
+  uint16_t _voltage;
+  uint8_t _chargingState;
+  bool _chargingMessages;
+  uint64_t _nextChargingMessage;
+  double _bogusBatteryRate;
+  double _corruptionRate;
+
+  // Songs and LEDs
+  uint8_t _songs[16][33];
+  uint8_t _songPlaying;
+  uint8_t _songNumber;
+  uint64_t _songEnd;
+  uint8_t _leds[3];
+
+  // Stream
+  uint8_t _streamPackets[64];
+  uint8_t _streamCount;
+  bool _streamPaused;
+
+  // Script
+  uint8_t _script[101];
+  uint8_t _scriptLength;
+  int _scriptPosition;
+  uint64_t _scriptWaitUntil;
+  double _scriptWaitDistance;
+  double _scriptWaitAngle;
+  int8_t _scriptWaitEvent;
+  bool _scriptWaiting;
+  bool _scripts;
+};
+
+#endif
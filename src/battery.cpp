@@ -0,0 +1,71 @@
+#include "battery.h"
+
+const int64_t MA_MS_PER_MAH = 3600000;
+// Time in ms
+// Time constant of the average current
+const int32_t AVERAGE_TIME = 60 * 1000;
+// Longer without a reading, e.g. the stream was down, the current in
+// between is unknown and not integrated
+const unsigned long MAX_INTEGRATION_GAP = 30 * 1000;
+// Below, the roomba is idle on or off the dock, no time is estimated
+const int16_t MIN_ESTIMATE_CURRENT = 50;
+
+CoulombCounter::CoulombCounter()
+  : _chargeMaMs(0), _capacityMah(0), _anchored(false), _started(false), _last(0), _average(0) {
+}
+
+void CoulombCounter::anchor(uint16_t chargeMah, uint16_t capacityMah){
+  _capacityMah = capacityMah;
+  _chargeMaMs = chargeMah * MA_MS_PER_MAH;
+  _anchored = true;
+}
+
+void CoulombCounter::update(int16_t currentMa, unsigned long now){
+  if(!_started){
+    _started = true;
+    _last = now;
+    _average = currentMa * 256;
+    return;
+  }
+  unsigned long elapsed = now - _last;
+  _last = now;
+  if(elapsed > MAX_INTEGRATION_GAP){
+    return;
+  }
+  _chargeMaMs += (int64_t) currentMa * (int64_t) elapsed;
+  int64_t capacity = _capacityMah * MA_MS_PER_MAH;
+  _chargeMaMs = _chargeMaMs < 0 ? 0 : (_chargeMaMs > capacity ? capacity : _chargeMaMs);
+  _average += (int64_t) (currentMa * 256 - _average) * (int64_t) elapsed / (int64_t) (AVERAGE_TIME + elapsed);
+}
+
+uint16_t CoulombCounter::chargeMah() const {
+  return (_chargeMaMs + MA_MS_PER_MAH / 2) / MA_MS_PER_MAH;
+}
+
+uint8_t CoulombCounter::percentage() const {
+  if(_capacityMah == 0){
+    return 0;
+  }
+  return (uint32_t) chargeMah() * 100 / _capacityMah;
+}
+
+int16_t CoulombCounter::averageCurrentMa() const {
+  return _average / 256;
+}
+
+int32_t CoulombCounter::minutesToEmpty() const {
+  int16_t current = averageCurrentMa();
+  if(!_anchored || current > -MIN_ESTIMATE_CURRENT){
+    return -1;
+  }
+  return _chargeMaMs / (-current * 60000LL);
+}
+
+int32_t CoulombCounter::minutesToFull() const {
+  int16_t current = averageCurrentMa();
+  if(!_anchored || current < MIN_ESTIMATE_CURRENT){
+    return -1;
+  }
+  // The current drops at the end of the charge, it takes longer
+  return (_capacityMah * MA_MS_PER_MAH - _chargeMaMs) / (current * 60000LL);
+}
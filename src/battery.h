@@ -0,0 +1,47 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <Arduino.h>
+
+/* State of charge estimated on the ESP by integrating the current of every
+ * battery reading (each 15 ms frame when streaming). The charge and
+ * capacity reported by the roomba only move by whole mAh and are sometimes
+ * garbage, they are read now and then to correct the drift : anchor().
+ * The charge is kept in mA.ms, 1 mAh is 3600000. */
+class CoulombCounter {
+public:
+  CoulombCounter();
+
+  // Charge and capacity read from the roomba, already range checked
+  void anchor(uint16_t chargeMah, uint16_t capacityMah);
+
+  // False until the first anchor(), the charge is not known yet
+  bool anchored() const { return _anchored; }
+
+  // Current of a reading in mA, negative when discharging. Integrated over
+  // the time since the previous reading, the first one only starts the clock
+  void update(int16_t currentMa, unsigned long now);
+
+  // Rounded, between 0 and the capacity
+  uint16_t chargeMah() const;
+  uint16_t capacityMah() const { return _capacityMah; }
+  uint8_t percentage() const;
+
+  // Average current over about a minute, mA
+  int16_t averageCurrentMa() const;
+
+  // At the average current, -1 when not discharging, respectively not charging
+  int32_t minutesToEmpty() const;
+  int32_t minutesToFull() const;
+
+private:
+  int64_t _chargeMaMs;
+  uint16_t _capacityMah;
+  bool _anchored;
+  bool _started;
+  unsigned long _last;
+  // mA * 256, low-pass filtered
+  int32_t _average;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "buffered_client.h"
+
+BufferedClient::BufferedClient(Client& client, uint8_t* buffer, size_t size)
+  : _client(client), _buffer(buffer), _size(size), _length(0), _holds(0), _segments(0), _failedWrites(0) {
+}
+
+int BufferedClient::connect(IPAddress ip, uint16_t port){
+  // Packets of the previous connection are meaningless to the new one
+  _length = 0;
+  return _client.connect(ip, port);
+}
+
+int BufferedClient::connect(const char* host, uint16_t port){
+  _length = 0;
+  return _client.connect(host, port);
+}
+
+size_t BufferedClient::write(uint8_t c){
+  return write(&c, 1);
+}
+
+size_t BufferedClient::write(const uint8_t* data, size_t size){
+  if(_holds == 0){
+    return push() && send(data, size) ? size : 0;
+  }
+  if(_length + size > _size && !push()){
+    return 0;
+  }
+  if(size > _size){
+    return send(data, size) ? size : 0;
+  }
+  memcpy(_buffer + _length, data, size);
+  _length += size;
+  return size;
+}
+
+bool BufferedClient::send(const uint8_t* data, size_t size){
+  if(size == 0){
+    return true;
+  }
+  _segments++;
+  if(_client.write(data, size) != size){
+    // Part of a packet may have gone out, the stream can't be resumed
+    _failedWrites++;
+    _client.stop();
+    return false;
+  }
+  return true;
+}
+
+bool BufferedClient::push(){
+  size_t length = _length;
+  _length = 0;
+  return send(_buffer, length);
+}
+
+void BufferedClient::stop(){
+  _length = 0;
+  _client.stop();
+}
+
+void BufferedClient::release(){
+  if(_holds > 0 && --_holds == 0){
+    flush();
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef BUFFERED_CLIENT_H
+#define BUFFERED_CLIENT_H
+
+#include <Arduino.h>
+
+/* Client between PubSubClient and the WiFiClient that gathers the MQTT
+ * packets of a burst of publishes into one TCP write. PubSubClient writes
+ * each packet, and beginPublish() streams a payload in many small writes,
+ * each of them is a segment once Nagle is off.
+ *
+ * Writes only wait in the buffer given by the caller between hold() and
+ * release(), the rest (connect, ping, acks) goes out right away. A full
+ * buffer is sent before taking more. When the socket doesn't take the
+ * whole buffer the connection is dropped, PubSubClient sees it as lost and
+ * telemetry is published again after the reconnection. */
+
+class BufferedClient : public Client {
+public:
+  BufferedClient(Client& client, uint8_t* buffer, size_t size);
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(const char* host, uint16_t port);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t* data, size_t size);
+  int available() { return _client.available(); }
+  int read() { return _client.read(); }
+  int read(uint8_t* data, size_t size) { return _client.read(data, size); }
+  int peek() { return _client.peek(); }
+  // Sends the buffered packets. The flush() of the WiFiClient is not called,
+  // older cores drop the received data there
+  void flush() { push(); }
+  // Same, false when the socket didn't take them and the connection was dropped
+  bool push();
+  void stop();
+  uint8_t connected() { return _client.connected(); }
+  operator bool() { return _client; }
+
+  // Holds can nest, the buffer is sent when the last one is released
+  void hold() { _holds++; }
+  void release();
+
+  // Writes to the underlying client and the ones it didn't take entirely
+  uint32_t segments() const { return _segments; }
+  uint32_t failedWrites() const { return _failedWrites; }
+
+private:
+  bool send(const uint8_t* data, size_t size);
+
+  Client& _client;
+  uint8_t* _buffer;
+  size_t _size;
+  size_t _length;
+  uint8_t _holds;
+  uint32_t _segments;
+  uint32_t _failedWrites;
+};
+
+// Holds the client for its scope, what is published in it leaves together
+class WriteBatch {
+public:
+  explicit WriteBatch(BufferedClient& client) : _client(client) { _client.hold(); }
+  ~WriteBatch() { _client.release(); }
+
+private:
+  BufferedClient& _client;
+};
+
+#endif
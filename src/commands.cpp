@@ -0,0 +1,76 @@
+#include "commands.h"
+
+static bool isSpace(uint8_t c){
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static unsigned int skipSpaces(const uint8_t* payload, unsigned int length, unsigned int i){
+  while(i < length && isSpace(payload[i])){
+    i++;
+  }
+  return i;
+}
+
+// Parses a signed decimal integer starting at i, which must be followed
+// by a space or the end of the payload
+static bool parseInt(const uint8_t* payload, unsigned int length, unsigned int& i, int32_t& value){
+  bool negative = false;
+  if(i < length && (payload[i] == '-' || payload[i] == '+')){
+    negative = payload[i] == '-';
+    i++;
+  }
+  unsigned int start = i;
+  int32_t result = 0;
+  while(i < length && payload[i] >= '0' && payload[i] <= '9'){
+    if(result > 100000000){
+      return false; // Way out of range of any command argument
+    }
+    result = result * 10 + (payload[i] - '0');
+    i++;
+  }
+  if(i == start || (i < length && !isSpace(payload[i]))){
+    return false;
+  }
+  value = negative ? -result : result;
+  return true;
+}
+
+CommandResult dispatchCommand(const Command* table, size_t tableSize,
+                              const uint8_t* payload, unsigned int length){
+  unsigned int nameStart = skipSpaces(payload, length, 0);
+  unsigned int nameEnd = nameStart;
+  while(nameEnd < length && !isSpace(payload[nameEnd])){
+    nameEnd++;
+  }
+  unsigned int nameLength = nameEnd - nameStart;
+
+  const Command* command = NULL;
+  for(size_t i = 0; i < tableSize; i++){
+    if(table[i].nameLength == nameLength &&
+       memcmp(table[i].name, payload + nameStart, nameLength) == 0){
+      command = &table[i];
+      break;
+    }
+  }
+  if(command == NULL){
+    return CommandUnknown;
+  }
+
+  CommandArgs args;
+  args.count = 0;
+  unsigned int i = skipSpaces(payload, length, nameEnd);
+  while(i < length){
+    if(args.count >= command->maxArgs ||
+       !parseInt(payload, length, i, args.values[args.count])){
+      return CommandBadArgs;
+    }
+    args.count++;
+    i = skipSpaces(payload, length, i);
+  }
+  if(args.count < command->minArgs){
+    return CommandBadArgs;
+  }
+
+  command->handler(args);
+  return CommandOk;
+}
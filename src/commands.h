@@ -0,0 +1,46 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <Arduino.h>
+
+/* Table driven dispatch of text commands such as "drive 200 -500".
+ * The payload is parsed in place, without copies or heap, and the name
+ * is matched on its length first then with memcmp. */
+
+const uint8_t MAX_COMMAND_ARGS = 4;
+
+struct CommandArgs {
+  uint8_t count;
+  int32_t values[MAX_COMMAND_ARGS];
+};
+
+typedef void (*CommandHandler)(const CommandArgs& args);
+
+struct Command {
+  const char* name;
+  uint8_t nameLength;
+  uint8_t minArgs;
+  uint8_t maxArgs;
+  CommandHandler handler;
+};
+
+// Table entry, the name length is computed at compile time
+#define COMMAND(name, minArgs, maxArgs, handler) { name, sizeof(name) - 1, minArgs, maxArgs, handler }
+
+enum CommandResult {
+  CommandOk,
+  CommandUnknown,
+  CommandBadArgs,
+};
+
+// Finds the command named by the first word of payload, parses the
+// following space separated integers and calls its handler
+CommandResult dispatchCommand(const Command* table, size_t tableSize,
+                              const uint8_t* payload, unsigned int length);
+
+template<size_t N>
+CommandResult dispatchCommand(const Command (&table)[N], const uint8_t* payload, unsigned int length){
+  return dispatchCommand(table, N, payload, length);
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include "coverage.h"
+
+const uint8_t MAX_RUN = 64;
+// Encoded bytes are written to the Print by chunks of this size
+const uint8_t ENCODE_CHUNK = 32;
+
+// Rounds towards minus infinity, so -1 mm is in cell -1 and not 0
+static int32_t floorDivide(int32_t value, int32_t divisor){
+  return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+// Collects the encoded bytes and writes them by chunks, or only counts them
+class ChunkWriter {
+public:
+  explicit ChunkWriter(Print* out) : _out(out), _length(0), _size(0) {}
+
+  void add(uint8_t value){
+    _size++;
+    if(_out == NULL){
+      return;
+    }
+    _chunk[_length++] = value;
+    if(_length == sizeof(_chunk)){
+      flush();
+    }
+  }
+
+  void flush(){
+    if(_out != NULL && _length > 0){
+      _out->write(_chunk, _length);
+    }
+    _length = 0;
+  }
+
+  size_t size() const { return _size; }
+
+private:
+  Print* _out;
+  uint8_t _chunk[ENCODE_CHUNK];
+  uint8_t _length;
+  size_t _size;
+};
+
+CoverageGrid::CoverageGrid(uint8_t* cells, uint8_t width, uint8_t height, uint16_t cellMm)
+  : _cells(cells), _width(width), _height(height), _cellMm(cellMm) {
+  clear();
+}
+
+void CoverageGrid::clear(){
+  memset(_cells, 0, coverageBytes(_width, _height));
+}
+
+void CoverageGrid::mark(int32_t xMm, int32_t yMm, CoverageCell value){
+  int32_t column = floorDivide(xMm, _cellMm) + _width / 2;
+  int32_t row = floorDivide(yMm, _cellMm) + _height / 2;
+  if(column < 0 || column >= _width || row < 0 || row >= _height){
+    return;
+  }
+  CoverageCell current = cell(column, row);
+  if(value == CellCovered && current != CellUnknown){
+    return;
+  }
+  if(value == CellObstacle && current == CellDock){
+    return;
+  }
+  size_t index = (size_t) row * _width + column;
+  uint8_t shift = (index % 4) * 2;
+  _cells[index / 4] = (_cells[index / 4] & ~(3 << shift)) | (value << shift);
+}
+
+CoverageCell CoverageGrid::cell(uint8_t column, uint8_t row) const {
+  size_t index = (size_t) row * _width + column;
+  return (CoverageCell) ((_cells[index / 4] >> ((index % 4) * 2)) & 3);
+}
+
+size_t CoverageGrid::encode(Print* out) const {
+  ChunkWriter writer(out);
+  writer.add(COVERAGE_MAP_VERSION);
+  writer.add(_width);
+  writer.add(_height);
+  writer.add(_cellMm & 0xff);
+  writer.add(_cellMm >> 8);
+
+  size_t count = (size_t) _width * _height;
+  uint8_t value = cell(0, 0);
+  uint8_t run = 0;
+  for(size_t index = 0; index < count; index++){
+    uint8_t next = (_cells[index / 4] >> ((index % 4) * 2)) & 3;
+    if(next != value || run == MAX_RUN){
+      writer.add((value << 6) | (run - 1));
+      value = next;
+      run = 0;
+    }
+    run++;
+  }
+  writer.add((value << 6) | (run - 1));
+  writer.flush();
+  return writer.size();
+}
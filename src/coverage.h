@@ -0,0 +1,56 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <Arduino.h>
+
+/* Map of a cleaning session, 2 bits per cell in a buffer given by the
+ * caller. The pose origin is the center of the grid, positions outside
+ * of it are ignored.
+ *
+ * Encoded map, version 1 :
+ *   0     version (COVERAGE_MAP_VERSION)
+ *   1     width in cells
+ *   2     height in cells
+ *   3-4   cell size, mm, little-endian
+ *   5...  runs of cells, row by row from the smallest y, one byte each :
+ *         the cell value in the 2 high bits and the run length - 1 in the
+ *         6 low bits */
+const uint8_t COVERAGE_MAP_VERSION = 1;
+const size_t COVERAGE_HEADER_SIZE = 5;
+
+enum CoverageCell {
+  CellUnknown = 0,
+  CellCovered = 1,
+  CellObstacle = 2,
+  CellDock = 3
+};
+
+// Bytes needed for a grid of width x height cells
+constexpr size_t coverageBytes(uint8_t width, uint8_t height){
+  return ((size_t) width * height + 3) / 4;
+}
+
+class CoverageGrid {
+public:
+  CoverageGrid(uint8_t* cells, uint8_t width, uint8_t height, uint16_t cellMm);
+
+  // Everything back to CellUnknown
+  void clear();
+
+  // Covered never replaces an obstacle or the dock
+  void mark(int32_t xMm, int32_t yMm, CoverageCell value);
+
+  CoverageCell cell(uint8_t column, uint8_t row) const;
+
+  // Writes the encoded map to out and returns its size. With out NULL only
+  // the size is computed, e.g. for beginPublish()
+  size_t encode(Print* out) const;
+
+private:
+  uint8_t* _cells;
+  uint8_t _width;
+  uint8_t _height;
+  uint16_t _cellMm;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "format.h"
+
+static size_t formatUnsigned(char* buffer, uint32_t value){
+  char digits[10];
+  uint8_t count = 0;
+  size_t length = 0;
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while(value > 0);
+  while(count > 0){
+    buffer[length++] = digits[--count];
+  }
+  buffer[length] = '\0';
+  return length;
+}
+
+// Magnitude as unsigned so INT32_MIN doesn't overflow
+static uint32_t magnitude(int32_t value){
+  return value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+}
+
+size_t formatInt(char* buffer, int32_t value){
+  size_t length = 0;
+  if(value < 0){
+    buffer[length++] = '-';
+  }
+  return length + formatUnsigned(buffer + length, magnitude(value));
+}
+
+size_t formatFixed(char* buffer, int32_t value, uint8_t decimals){
+  if(decimals == 0){
+    return formatInt(buffer, value);
+  }
+  size_t length = 0;
+  if(value < 0){
+    buffer[length++] = '-';
+  }
+  // The digits are split around the point, missing leading zeros are
+  // added, e.g. 5 with 2 decimals is "0.05"
+  char digits[11];
+  size_t count = formatUnsigned(digits, magnitude(value));
+  size_t integerDigits = count > decimals ? count - decimals : 0;
+  if(integerDigits == 0){
+    buffer[length++] = '0';
+  }
+  for(size_t i = 0; i < integerDigits; i++){
+    buffer[length++] = digits[i];
+  }
+  buffer[length++] = '.';
+  for(size_t i = count; i < decimals; i++){
+    buffer[length++] = '0';
+  }
+  for(size_t i = integerDigits; i < count; i++){
+    buffer[length++] = digits[i];
+  }
+  buffer[length] = '\0';
+  return length;
+}
+
+TextBuffer::TextBuffer(char* buffer, size_t size)
+  : _buffer(buffer), _size(size), _length(0) {
+  _buffer[0] = '\0';
+}
+
+TextBuffer& TextBuffer::add(const char* text){
+  while(*text != '\0' && _length + 1 < _size){
+    _buffer[_length++] = *text++;
+  }
+  _buffer[_length] = '\0';
+  return *this;
+}
+
+TextBuffer& TextBuffer::addInt(int32_t value){
+  char number[INT_BUFFER_SIZE];
+  formatInt(number, value);
+  return add(number);
+}
+
+TextBuffer& TextBuffer::addFixed(int32_t value, uint8_t decimals){
+  char number[FIXED_BUFFER_SIZE];
+  formatFixed(number, value, decimals < 9 ? decimals : 9);
+  return add(number);
+}
+
+void TextBuffer::clear(){
+  _length = 0;
+  _buffer[0] = '\0';
+}
@@ -0,0 +1,40 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <Arduino.h>
+
+/* Text formatting into caller provided buffers, without String or heap.
+ * Numbers are integers or fixed point (an integer count of 1/10^decimals),
+ * the ESP8266 has no FPU anyway. */
+
+// Writes value in decimal, returns the number of characters written.
+// buffer needs room for 12 characters including the terminating 0.
+const size_t INT_BUFFER_SIZE = 12;
+size_t formatInt(char* buffer, int32_t value);
+
+// Writes value / 10^decimals with exactly decimals digits after the point,
+// e.g. formatFixed(buffer, 1623, 2) gives "16.23". decimals must be at
+// most 9 for the result to fit in FIXED_BUFFER_SIZE characters.
+const size_t FIXED_BUFFER_SIZE = 14;
+size_t formatFixed(char* buffer, int32_t value, uint8_t decimals);
+
+// Appends text and numbers to a fixed size buffer, truncating when full
+class TextBuffer {
+public:
+  TextBuffer(char* buffer, size_t size);
+
+  TextBuffer& add(const char* text);
+  TextBuffer& addInt(int32_t value);
+  TextBuffer& addFixed(int32_t value, uint8_t decimals);
+
+  void clear();
+  const char* c_str() const { return _buffer; }
+  size_t length() const { return _length; }
+
+private:
+  char* _buffer;
+  size_t _size;
+  size_t _length;
+};
+
+#endif
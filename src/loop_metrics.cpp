@@ -0,0 +1,37 @@
+#include "loop_metrics.h"
+#include "format.h"
+
+StageMetrics::StageMetrics(){
+  reset();
+}
+
+void StageMetrics::record(unsigned long us){
+  uint8_t bucket = 0;
+  while(bucket < LATENCY_BUCKETS - 1 && us >= LATENCY_BUCKET_LIMITS[bucket]){
+    bucket++;
+  }
+  _buckets[bucket]++;
+  _count++;
+  if(us > _max){
+    _max = us;
+  }
+}
+
+void StageMetrics::reset(){
+  memset(_buckets, 0, sizeof(_buckets));
+  _count = 0;
+  _max = 0;
+}
+
+size_t StageMetrics::format(char* buffer, size_t size) const {
+  TextBuffer text(buffer, size);
+  text.add("{\"n\":").addInt(_count).add(",\"max\":").addInt(_max).add(",\"h\":[");
+  for(uint8_t i = 0; i < LATENCY_BUCKETS; i++){
+    if(i > 0){
+      text.add(",");
+    }
+    text.addInt(_buckets[i]);
+  }
+  text.add("]}");
+  return text.length();
+}
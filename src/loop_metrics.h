@@ -0,0 +1,52 @@
+#ifndef LOOP_METRICS_H
+#define LOOP_METRICS_H
+
+#include <Arduino.h>
+
+/* Latency histograms of the stages of loop(), measured with micros().
+ * Each stage keeps counts in fixed buckets and its max over the current
+ * publish window. */
+
+const uint8_t LATENCY_BUCKETS = 8;
+
+// Upper bounds of the buckets in us, the last one catches everything else
+const unsigned long LATENCY_BUCKET_LIMITS[LATENCY_BUCKETS - 1] = {
+  50, 200, 1000, 5000, 20000, 100000, 500000
+};
+
+class StageMetrics {
+public:
+  StageMetrics();
+
+  void record(unsigned long us);
+  void reset();
+
+  // Formats {"n":...,"max":...,"h":[...]} in buffer, returns the length
+  size_t format(char* buffer, size_t size) const;
+
+  uint32_t count() const { return _count; }
+  uint32_t max() const { return _max; }
+
+private:
+  uint32_t _buckets[LATENCY_BUCKETS];
+  uint32_t _count;
+  uint32_t _max;
+};
+
+// Records the time spent in its scope, does nothing with a NULL stage so
+// the measure compiles away when metrics are disabled
+class StageTimer {
+public:
+  explicit StageTimer(StageMetrics* stage) : _stage(stage), _start(stage ? micros() : 0) {}
+  ~StageTimer() {
+    if(_stage){
+      _stage->record(micros() - _start);
+    }
+  }
+
+private:
+  StageMetrics* _stage;
+  unsigned long _start;
+};
+
+#endif
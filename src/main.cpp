@@ -9,15 +9,89 @@
 
 // contains wifi and mqtt credentials
 #include "secrets.h"
+#include "scheduler.h"
+#include "format.h"
+#include "telemetry.h"
+#include "commands.h"
+#include "loop_metrics.h"
+#include "songs.h"
+#include "odometry.h"
+#include "coverage.h"
+#include "patterns.h"
+#include "sensors.h"
+#include "stream_parser.h"
+#include "battery.h"
+#include "buffered_client.h"
 
 #define LED_OFF HIGH
 #define LED_ON LOW
 #define LED 2
 
 // Time in ms
-const unsigned long MAX_WIFI_TIMEOUT = 15 * 1000;
-const unsigned long MAX_CLIENT_TIMEOUT = 120 * 1000;
+// Restart the ESP as a last resort after being offline that long
+const unsigned long MAX_WIFI_TIMEOUT = 10 * 60 * 1000;
+const unsigned long MAX_CLIENT_TIMEOUT = 30 * 60 * 1000;
+const unsigned long MIN_MQTT_RETRY = 1000;
+const unsigned long MAX_MQTT_RETRY = 30 * 1000;
+// Seconds, bounds how long a connection attempt can stall loop()
+const uint16_t MQTT_SOCKET_TIMEOUT_S = 2;
 const unsigned long TIME_BETWEEN_MQTT_UPDATE = 10 * 1000;
+const unsigned long TIME_BETWEEN_TELEMETRY_CHECK = 1000;
+const unsigned long TELEMETRY_HEARTBEAT = 5 * 60 * 1000;
+const unsigned long TIME_BETWEEN_METRICS = 60 * 1000;
+const unsigned long TIME_BETWEEN_OFFLINE_SAMPLES = 10 * 1000;
+const unsigned long TIME_BETWEEN_BACKLOG_BATCHES = 250;
+const unsigned long TIME_BETWEEN_BATTERY_STATS = 10 * 1000;
+const unsigned long TIME_BETWEEN_POSE = 1000;
+// Charge and capacity read from the roomba to correct the coulomb counter,
+// sooner when the last read failed
+const unsigned long TIME_BETWEEN_BATTERY_ANCHORS = 10 * 60 * 1000;
+const unsigned long BATTERY_ANCHOR_RETRY = 10 * 1000;
+// Wheels stop when roomba/drive is silent that long
+const unsigned long TELEOP_DEADMAN = 300;
+const unsigned long MAX_STREAM_SILENCE = 1000;
+// Polls in a row without a reply before the OI is started again
+const uint8_t MAX_POLL_TIMEOUTS = 3;
+const unsigned long MIN_TIME_BETWEEN_SENSOR_ERRORS = 5 * 1000;
+// Restart command acknowledged and the ack sent by lwIP before rebooting
+const unsigned long RESTART_DELAY = 100;
+// After a mode change, a few 15 ms updates of the roomba
+const unsigned long MODE_CHANGE_WAIT = 50;
+// The stream frame in flight fully arrived after a pause
+const unsigned long STREAM_PAUSE_WAIT = 30;
+
+// Let the roomba push sensor data every 15 ms instead of polling it
+const bool STREAM_SENSORS = true;
+
+// Telemetry is published on one topic per value, and/or as a single
+// binary frame on roomba/telemetry (layout in telemetry.h)
+const bool PUBLISH_TELEMETRY_TOPICS = true;
+const bool PUBLISH_TELEMETRY_FRAME = false;
+
+// Min, mean and max of the current and voltage of every battery packet
+// (each 15 ms frame when streaming), published on roomba/battery/stats
+const bool PUBLISH_BATTERY_STATS = true;
+
+// Position integrated from the distance and angle of the stream frames,
+// published on roomba/pose when it changed. Needs STREAM_SENSORS
+const bool PUBLISH_POSE = true;
+
+// Map of the current cleaning built from the pose, bumps and wall sensor,
+// 128 x 128 cells of 10 cm in 4 KB. Sent on roomba/map by the map command
+const uint8_t COVERAGE_GRID_SIZE = 128;
+const uint16_t COVERAGE_CELL_MM = 100;
+
+// Telemetry kept in RAM while the broker is unreachable, 20 bytes each.
+// Sent back on roomba/telemetry/backlog once reconnected, a batch at a time
+const uint16_t OFFLINE_SAMPLES = 128;
+const uint8_t BACKLOG_BATCH_SAMPLES = 16;
+
+// MQTT packets of a telemetry burst gathered into one TCP write, the MSS
+// of lwIP on the ESP8266 so a full buffer is one segment
+const size_t MQTT_WRITE_BUFFER_SIZE = 536;
+
+// Latency histograms of each stage of loop(), published on roomba/metrics/<stage>
+const bool LOOP_METRICS = true;
 
 // Put to false when connected to roomba to not send bogus data
 const bool PRINT_DEBUG = false;
@@ -40,32 +114,52 @@ void printlnDebug(const T& val){
 
 // Roomba declaration and sensor variables
 Roomba roomba(&Serial, Roomba::Baud115200);
+SongPlayer songPlayer(roomba);
 
-uint8_t buffer2Bytes[2];
+// Charge, capacity and percentage come from the coulomb counter
+CoulombCounter batteryCounter;
 uint16_t battCharge = 0;
 uint16_t battCappacity = 0;
-float battPercentage = 0;
-float battVoltage = 0;
+uint8_t battPercentage = 0;
 uint16_t battVoltageMV = 0;
 int16_t battCurrent = 0;
 uint8_t chargingState = 0;
+// False until the first battery packet, the values above are not real yet
+bool batteryReceived = false;
+// Origin at the dock or where the last cleaning started
+Odometry odometry;
+uint8_t coverageCells[coverageBytes(COVERAGE_GRID_SIZE, COVERAGE_GRID_SIZE)];
+CoverageGrid coverage(coverageCells, COVERAGE_GRID_SIZE, COVERAGE_GRID_SIZE, COVERAGE_CELL_MM);
+// Every valid reading since the last roomba/battery/stats
+RangeStats currentStats;
+RangeStats voltageStats;
 
-// NTP for time of the day - not really usefull now
+// NTP for time of the day, timestamps the offline backlog
 const auto utcOffsetInSeconds = -4 * 60 * 60; // UTC -4
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, "north-america.pool.ntp.org", utcOffsetInSeconds);
 
 WiFiClient wifiClient;
-PubSubClient client(wifiClient);
+uint8_t mqttWriteBuffer[MQTT_WRITE_BUFFER_SIZE];
+BufferedClient bufferedClient(wifiClient, mqttWriteBuffer, sizeof(mqttWriteBuffer));
+PubSubClient client(bufferedClient);
 
 
 void toggle(uint8_t pin){
   digitalWrite(pin, !digitalRead(pin));
 }
 
-template<typename T>
-void publishDebug(const T& message){
-  client.publish("roomba/debug", String(message).c_str());
+// Telemetry and debug messages are formatted in fixed buffers, String
+// allocations fragment the small heap over weeks of uptime
+void publishDebug(const char* message){
+  client.publish("roomba/debug", message);
+}
+
+void publishDebug(const char* label, int32_t value, uint8_t decimals = 0){
+  char message[64];
+  TextBuffer text(message, sizeof(message));
+  text.add(label).add(" : ").addFixed(value, decimals);
+  publishDebug(message);
 }
 
 void setupOTA(){
@@ -108,312 +202,1236 @@ void setupOTA(){
   ArduinoOTA.begin();
 }
 
-void restartIfWifiIsDiconnected(){
-  // Restart the MCU if the wifi is disconnnected for too long
-  static int lastWifiConnected = 0;
-  if(!WiFi.isConnected()){
-    printlnDebug("Wifi disconnected");
-    while(!WiFi.isConnected()){
-      if(millis() - lastWifiConnected > MAX_WIFI_TIMEOUT) {
-        printlnDebug("Could not connect to wifi, restarting");
-        ESP.restart();
-      }
-      delay(100);
-    }
+// Stays the same across reconnects so the broker keeps our session
+char mqttClientId[24];
+
+void setupClientId(){
+  TextBuffer id(mqttClientId, sizeof(mqttClientId));
+  id.add("esp8266Roomba-").addInt(ESP.getChipId());
+}
+
+enum ConnectionState {
+  ConnectionWifiDown,
+  ConnectionMqttDown,
+  ConnectionUp
+};
+
+// Reconnection runs a step at a time from loop(), the roomba keeps being
+// served in between
+ConnectionState connectionState = ConnectionWifiDown;
+unsigned long wifiLostAt = 0;
+unsigned long mqttLostAt = 0;
+Backoff mqttRetry(MIN_MQTT_RETRY, MAX_MQTT_RETRY);
+bool otaStarted = false;
+bool bootAnnounced = false;
+
+void invalidateTelemetry();
+
+bool connectMqtt(){
+  // Persistent session, the broker queues the commands sent while we are away
+  if(!client.connect(mqttClientId, MQTT_USER, MQTT_PASSWORD, "roomba/status", 0, 0, "disconnected", false)){
+    return false;
   }
-  else {
-    lastWifiConnected = millis();
+  client.subscribe("roomba/commands", 1);
+  // QoS 0, wheel speeds queued during an outage must not be replayed
+  client.subscribe("roomba/drive", 0);
+  if(!bootAnnounced){
+    client.publish("online", "roombaEsp8266"); // Send on boot that we are online, mostly for debugging
+    bootAnnounced = true;
   }
+  // Subscribers may have missed changes while disconnected
+  invalidateTelemetry();
+  return true;
 }
 
-void restartIfClientDisconnected() {
-  static int lastClientConnected = 0;
-  if(!client.connected()){
-    printlnDebug("Client disconnected");
-    while(!client.connected()){
-      if(millis() - lastClientConnected > MAX_CLIENT_TIMEOUT) {
+void maintainConnection(){
+  unsigned long now = millis();
+  switch(connectionState){
+    case ConnectionWifiDown:
+      // The SDK reconnects the wifi by itself
+      if(WiFi.isConnected()){
+        printDebug("WiFi connected\nIP : ");
+        printlnDebug(WiFi.localIP());
+        if(!otaStarted){
+          setupOTA();
+          otaStarted = true;
+        }
+        // Fresh link, try the broker right away. Its restart timeout runs
+        // from now, not from before the wifi outage
+        mqttRetry.succeeded();
+        mqttLostAt = now;
+        connectionState = ConnectionMqttDown;
+      }
+      else if(now - wifiLostAt > MAX_WIFI_TIMEOUT){
+        printlnDebug("Could not connect to wifi, restarting");
+        ESP.restart();
+      }
+      break;
+
+    case ConnectionMqttDown:
+      if(!WiFi.isConnected()){
+        printlnDebug("Wifi disconnected");
+        wifiLostAt = now;
+        connectionState = ConnectionWifiDown;
+      }
+      else if(mqttRetry.due(now)){
+        if(connectMqtt()){
+          printlnDebug("MQTT connected");
+          mqttRetry.succeeded();
+          connectionState = ConnectionUp;
+        }
+        else {
+          mqttRetry.failed(now);
+        }
+      }
+      else if(now - mqttLostAt > MAX_CLIENT_TIMEOUT){
         printlnDebug("MQTT could not connect to server, restarting");
         ESP.restart();
       }
-      String clientId = "esp8266Roomba-";
-      clientId += String(random(0xFFFF), HEX);
-      client.connect(clientId.c_str(), MQTT_USER, MQTT_PASSWORD, "roomba/status", 0, 0, "disconnected");
-      client.subscribe("roomba/commands");
+      break;
 
-      ArduinoOTA.handle();
-      delay(100);
+    case ConnectionUp:
+      if(!client.connected()){
+        printlnDebug("Client disconnected");
+        mqttLostAt = now;
+        connectionState = ConnectionMqttDown;
+      }
+      break;
+  }
+}
+
+// Sensors of each feature, the packets asked to the roomba are planned
+// from them (see sensors.h)
+const SensorSet BATTERY_SENSORS = sensorSet(Roomba::SensorChargingState, Roomba::SensorVoltage,
+  Roomba::SensorCurrent);
+// Only read every TIME_BETWEEN_BATTERY_ANCHORS, the charge is integrated
+// from the current in between
+const SensorSet ANCHOR_SENSORS = sensorSet(Roomba::SensorBatteryCharge, Roomba::SensorBatteryCapacity);
+// Since the previous frame
+const SensorSet POSE_SENSORS = sensorSet(Roomba::SensorDistance, Roomba::SensorAngle);
+const SensorSet COVERAGE_SENSORS = sensorSet(Roomba::SensorBumpsAndWheelDrops, Roomba::SensorWall);
+// Keeps the mode tracked by the driver right when the roomba leaves safe
+// mode by itself
+const SensorSet MODE_SENSORS = sensorSet(Roomba::SensorOIMode);
+
+// Values of the last frame or polled reply
+SensorReadings readings;
+
+// Debug message for out of range sensor values, rate limited since
+// streamed packets are decoded 66 times per second
+void publishSensorError(const char* label, int32_t value, uint8_t decimals = 0){
+  static unsigned long lastSensorError = 0;
+  static bool sentSensorError = false;
+  if(!sentSensorError || millis() - lastSensorError > MIN_TIME_BETWEEN_SENSOR_ERRORS){
+    publishDebug(label, value, decimals);
+    lastSensorError = millis();
+    sentSensorError = true;
+  }
+}
+
+// Out of range values are dropped, the previous one is kept
+void reportRejectedSensors(){
+  SensorSet rejected = readings.rejected();
+  for(uint8_t id = FIRST_SENSOR_PACKET; rejected != 0 && id <= LAST_SENSOR_PACKET; id++){
+    if(rejected & sensorSet(id)){
+      char label[16];
+      TextBuffer text(label, sizeof(label));
+      text.add("Sensor ").addInt(id);
+      publishSensorError(label, readings.value(id), sensorSpec(id).decimals);
+      return;
     }
   }
-  else {
-    lastClientConnected = millis();
+}
+
+void updateBatteryEstimate(){
+  if(!batteryCounter.anchored()){
+    return;
+  }
+  battCharge = batteryCounter.chargeMah();
+  battCappacity = batteryCounter.capacityMah();
+  battPercentage = batteryCounter.percentage();
+  batteryReceived = true;
+}
+
+void applyBatteryReadings(){
+  if(!readings.received(BATTERY_SENSORS)){
+    return;
   }
+  if(readings.has(Roomba::SensorChargingState)){
+    chargingState = readings.value(Roomba::SensorChargingState);
+  }
+  if(readings.has(Roomba::SensorVoltage)){
+    battVoltageMV = readings.value(Roomba::SensorVoltage);
+    voltageStats.add(battVoltageMV);
+  }
+  if(readings.has(Roomba::SensorCurrent)){
+    battCurrent = readings.value(Roomba::SensorCurrent);
+    currentStats.add(battCurrent);
+    batteryCounter.update(battCurrent, millis());
+  }
+  updateBatteryEstimate();
 }
 
-uint16_t buffToInt(const uint8_t* buff) {
-  return (buff[0] << 8) | buff[1];
+// Pushed by the roomba every 15 ms in stream mode
+const SensorSet STREAMED_SENSORS = BATTERY_SENSORS | POSE_SENSORS | COVERAGE_SENSORS | MODE_SENSORS;
+SensorPlan<STREAMED_SENSORS> streamPlan;
+unsigned long lastStreamFrame = 0;
+bool onDock = false;
+
+// Charging states 1 to 4 mean it sits on the dock, which becomes the origin
+void resetPoseOnDock(){
+  bool docked = chargingState >= 1 && chargingState <= 4;
+  if(docked && !onDock){
+    odometry.reset();
+    coverage.mark(0, 0, CellDock);
+  }
+  onDock = docked;
 }
 
-void updateBatteryCharge(){
-  const uint16_t THRESHOLD_ERROR = 5000; // The biggest battery is about 4000 mAh
-  roomba.start();
-  delay(100);
-  if(roomba.getSensors(roomba.SensorBatteryCapacity, buffer2Bytes, 2)){
-    uint16_t oldVal = battCappacity;  // Fix for bug where the roomba return a super big value
-    battCappacity = buffToInt(buffer2Bytes);
-    if(battCappacity > THRESHOLD_ERROR) {
-      String debugMessage = "Capacity : " + String(battCappacity); 
-      publishDebug(debugMessage);
-      battCappacity = oldVal;
-    }
+// Robot outline in mm, from the center
+const int32_t ROBOT_RADIUS = 170;
+const int32_t BRUSH_HALF_WIDTH = 120;
+
+// Marks the cells at a position relative to the robot
+void markCoverage(int32_t forwardMm, int32_t leftMm, CoverageCell value){
+  int32_t x, y;
+  odometry.project(forwardMm, leftMm, x, y);
+  coverage.mark(x, y, value);
+}
+
+// Streamed in chunks, the encoded map is never held in RAM
+void publishCoverage(){
+  WriteBatch batch(bufferedClient);
+  size_t length = coverage.encode(NULL);
+  if(!client.beginPublish("roomba/map", length, false)){
+    return;
   }
-  delay(100);
-  if(roomba.getSensors(roomba.SensorBatteryCharge, buffer2Bytes, 2)){
-    uint16_t oldVal = battCappacity; // Same fix
-    battCharge = buffToInt(buffer2Bytes);
-    if(battCharge > THRESHOLD_ERROR) {
-      String debugMessage = "Charge : " + String(battCharge); 
-      publishDebug(debugMessage);
-      battCharge = oldVal;
+  coverage.encode(&client);
+  client.endPublish();
+}
+
+// Bit 0 is the right bumper, bit 1 the left one
+void markBumps(uint8_t bumps){
+  const int32_t ahead = ROBOT_RADIUS + COVERAGE_CELL_MM / 2;
+  switch(bumps & 3){
+    case 1:
+      markCoverage(ahead, -BRUSH_HALF_WIDTH, CellObstacle);
+      break;
+    case 2:
+      markCoverage(ahead, BRUSH_HALF_WIDTH, CellObstacle);
+      break;
+    case 3:
+      markCoverage(ahead, 0, CellObstacle);
+      break;
+  }
+}
+
+// Filled across several loop() calls, a frame takes longer to arrive
+uint8_t streamFrame[streamPlan.FRAME_SIZE + STREAM_FRAME_OVERHEAD];
+StreamParser streamParser(streamFrame, sizeof(streamFrame));
+
+void startSensorStream(){
+  roomba.stream(streamPlan.packets, streamPlan.COUNT);
+  streamParser.expect(streamPlan.FRAME_SIZE);
+  streamParser.reset();
+  lastStreamFrame = millis();
+}
+
+// Bumps and wall are placed with the pose updated by the same frame
+void applyStreamReadings(){
+  applyBatteryReadings();
+  resetPoseOnDock();
+  if(readings.has(Roomba::SensorDistance) && readings.has(Roomba::SensorAngle)){
+    int16_t distance = readings.value(Roomba::SensorDistance);
+    int16_t angle = readings.value(Roomba::SensorAngle);
+    odometry.update(distance, angle);
+    if(distance != 0 || angle != 0){
+      markCoverage(0, 0, CellCovered);
+      markCoverage(0, BRUSH_HALF_WIDTH, CellCovered);
+      markCoverage(0, -BRUSH_HALF_WIDTH, CellCovered);
     }
   }
-  battPercentage = (float) battCharge / (float) battCappacity * 100;
-  delay(100);
+  if(readings.has(Roomba::SensorBumpsAndWheelDrops)){
+    markBumps(readings.value(Roomba::SensorBumpsAndWheelDrops));
+  }
+  // The wall sensor looks to the right
+  if(readings.has(Roomba::SensorWall) && readings.value(Roomba::SensorWall)){
+    markCoverage(0, -(ROBOT_RADIUS + COVERAGE_CELL_MM / 2), CellObstacle);
+  }
+  if(readings.has(Roomba::SensorOIMode)){
+    roomba.modeObserved(readings.value(Roomba::SensorOIMode));
+  }
 }
 
-void updateChargingState() {
-  const uint8_t MAX_CHARGE_STATE = 5;
+// Packets are read in place in the parser buffer
+void decodeStreamFrame(){
+  readings.clear();
+  for(uint8_t i = 0; i < streamParser.packetCount(); i++){
+    readings.decodePacket(streamParser.packetId(i), streamParser.packetData(i));
+  }
+  reportRejectedSensors();
+  applyStreamReadings();
+}
+
+// Script in the roomba, uploaded again when another pattern runs
+const Pattern* loadedPattern = NULL;
+
+// After a reboot the OI is off and the roomba lost its songs and script
+void restartRoombaOI(){
   roomba.start();
-  delay(100);
-  if(roomba.getSensors(roomba.SensorChargingState, buffer2Bytes, 1)){
-    uint8_t oldVal = chargingState;
-    chargingState = buffer2Bytes[0];
-    if(chargingState > MAX_CHARGE_STATE) {
-      String debugMessage = "Charging state : " + String(chargingState); 
-      publishDebug(debugMessage);
-      chargingState = oldVal;
+  songPlayer.invalidate();
+  loadedPattern = NULL;
+}
+
+void pollSensorStream(){
+  if(serialOverrun(Serial)){
+    streamParser.overrun();
+  }
+  // Only consumes the bytes already received, never waits for the roomba.
+  // Every frame is decoded, several may be waiting after a long loop()
+  bool received = false;
+  while(Serial.available() > 0){
+    if(streamParser.feed(Serial.read())){
+      decodeStreamFrame();
+      received = true;
     }
   }
-  delay(100);
+  if(received){
+    lastStreamFrame = millis();
+  }
+  else if(millis() - lastStreamFrame > MAX_STREAM_SILENCE){
+    // The roomba rebooted or dropped the stream, ask for it again
+    restartRoombaOI();
+    startSensorStream();
+    printlnDebug("Restarted sensor stream");
+  }
+}
+
+// Replies read while the stream is paused so they aren't mixed with
+// frames, the charge and capacity and the script read back. The query
+// resumes the stream when its transaction ends, whatever happened to
+// what started it
+enum StreamQueryState {
+  QueryIdle,
+  QueryPausing,
+  QueryReading
+};
+
+StreamQueryState streamQueryState = QueryIdle;
+unsigned long streamPausedAt = 0;
+// Sends the request once the frame in flight arrived
+bool (*streamQuery)() = NULL;
+
+// False while another query runs
+bool pauseStreamFor(bool (*query)()){
+  if(streamQueryState != QueryIdle){
+    return false;
+  }
+  streamQuery = query;
+  roomba.streamCommand(Roomba::StreamCommandPause);
+  streamPausedAt = millis();
+  streamQueryState = QueryPausing;
+  return true;
+}
+
+// From the callback of the query's transaction
+void resumeStream(){
+  roomba.streamCommand(Roomba::StreamCommandResume);
+  streamParser.reset();
+  lastStreamFrame = millis();
+  streamQueryState = QueryIdle;
 }
 
-void updateVoltageCurrent(){
-  const float MAX_VOLTAGE = 25.0; // should never be greater than about 17V fully charged
-  const float MAX_CURRENT = 6000; // Uses about 2A in regular use
+void runStreamQuery(){
+  if(streamQueryState == QueryPausing && millis() - streamPausedAt >= STREAM_PAUSE_WAIT && streamQuery()){
+    streamQueryState = QueryReading;
+  }
+}
+
+// Notes taken from https://github.com/t0ph/ArduinoRoombaControl/blob/master/RoombaImperialMarch.ino
+constexpr uint8_t imperialMarchA[] PROGMEM = { 55, 32, 55, 32, 55, 32, 51, 24, 58, 8, 55, 32, 51, 24, 58, 8, 55, 64 };
+constexpr uint8_t imperialMarchB[] PROGMEM = { 62, 32, 62, 32, 62, 32, 63, 24, 58, 8, 54, 32, 51, 24, 58, 8, 55, 64 };
+constexpr uint8_t imperialMarchC[] PROGMEM = { 67, 32, 55, 24, 55, 8, 67, 32, 66, 24, 65, 8, 64, 8, 63, 8, 64, 16, 30, 16, 56, 16, 61, 32 };
+constexpr uint8_t imperialMarchD[] PROGMEM = { 60, 24, 59, 8, 58, 8, 57, 8, 58, 16, 10, 16, 52, 16, 54, 32, 51, 24, 58, 8, 55, 32, 51, 24, 58, 8, 55, 64 };
+
+constexpr Song imperialMarchParts[] = {
+  makeSong<1>(imperialMarchA),
+  makeSong<2>(imperialMarchB),
+  makeSong<3>(imperialMarchC),
+  makeSong<4>(imperialMarchD),
+};
+
+const Song* const imperialMarch[] = {
+  &imperialMarchParts[0],
+  &imperialMarchParts[1],
+  &imperialMarchParts[2],
+  &imperialMarchParts[3],
+};
+
+// Backs off a bump and turns 90° to the left
+constexpr uint8_t backoffScript[] PROGMEM = {
+  SCRIPT_DRIVE(-200, SCRIPT_STRAIGHT), SCRIPT_WAIT_DISTANCE(-150),
+  SCRIPT_DRIVE(200, SCRIPT_TURN_LEFT), SCRIPT_WAIT_ANGLE(90),
+  SCRIPT_STOP,
+};
+
+// One turn on each radius, about 3.5 m wide at the end
+constexpr uint8_t spiralScript[] PROGMEM = {
+  SCRIPT_DRIVE(200, 150), SCRIPT_WAIT_ANGLE(360),
+  SCRIPT_DRIVE(200, 400), SCRIPT_WAIT_ANGLE(360),
+  SCRIPT_DRIVE(250, 650), SCRIPT_WAIT_ANGLE(360),
+  SCRIPT_DRIVE(250, 900), SCRIPT_WAIT_ANGLE(360),
+  SCRIPT_DRIVE(300, 1150), SCRIPT_WAIT_ANGLE(360),
+  SCRIPT_DRIVE(300, 1400), SCRIPT_WAIT_ANGLE(360),
+  SCRIPT_DRIVE(300, 1650), SCRIPT_WAIT_ANGLE(360),
+  SCRIPT_STOP,
+};
+
+// Edge passes around a 1 m square, turning right at each corner
+constexpr uint8_t squareScript[] PROGMEM = {
+  SCRIPT_DRIVE(250, SCRIPT_STRAIGHT), SCRIPT_WAIT_DISTANCE(1000),
+  SCRIPT_DRIVE(150, SCRIPT_TURN_RIGHT), SCRIPT_WAIT_ANGLE(-90),
+  SCRIPT_DRIVE(250, SCRIPT_STRAIGHT), SCRIPT_WAIT_DISTANCE(1000),
+  SCRIPT_DRIVE(150, SCRIPT_TURN_RIGHT), SCRIPT_WAIT_ANGLE(-90),
+  SCRIPT_DRIVE(250, SCRIPT_STRAIGHT), SCRIPT_WAIT_DISTANCE(1000),
+  SCRIPT_DRIVE(150, SCRIPT_TURN_RIGHT), SCRIPT_WAIT_ANGLE(-90),
+  SCRIPT_DRIVE(250, SCRIPT_STRAIGHT), SCRIPT_WAIT_DISTANCE(1000),
+  SCRIPT_DRIVE(150, SCRIPT_TURN_RIGHT), SCRIPT_WAIT_ANGLE(-90),
+  SCRIPT_STOP,
+};
+
+constexpr Pattern backoffPattern = makePattern("backoff", backoffScript);
+constexpr Pattern spiralPattern = makePattern("spiral", spiralScript);
+constexpr Pattern squarePattern = makePattern("square", squareScript);
+
+// Commands sent to the roomba, run one step at a time from loop()
+Sequence roombaSequence;
+
+// Mode steps only send what the tracked mode needs, and don't wait when
+// the roomba is already there
+void roombaStart(){
+  if(roomba.modeKnown() && roomba.mode() != Roomba::ModeOff){
+    roombaSequence.skipWait();
+    return;
+  }
   roomba.start();
-  delay(100);
-  if(roomba.getSensors(Roomba::SensorVoltage, buffer2Bytes, 2)){
-    battVoltageMV = buffToInt(buffer2Bytes);
-    float oldVal = battVoltage;
-    battVoltage = (float) battVoltageMV / 1000.0f;
-    if(battVoltage > MAX_VOLTAGE){
-      String debugMessage = "Voltage : " + String(battVoltage); 
-      publishDebug(debugMessage);
-      battVoltage = oldVal;
-    }
+}
+
+void roombaSafeMode(){
+  if(!roomba.ensureMode(Roomba::ModeSafe)){
+    roombaSequence.skipWait();
   }
-  delay(100);
-  if(roomba.getSensors(Roomba::SensorCurrent, buffer2Bytes, 2)){
-    int16_t oldVal = battCurrent;
-    battCurrent = buffToInt(buffer2Bytes);
-    if(abs(battCurrent) > MAX_CURRENT) {
-      String debugMessage = "Current : " + String(battCurrent); 
-      publishDebug(debugMessage);
-      battCurrent = oldVal;
+}
+
+const Step startCleaningSteps[] = {
+  { roombaSafeMode, MODE_CHANGE_WAIT }, // Probably only needed for series 600
+  { []() {
+      roomba.cover(); // Sends clean command
+      client.publish("roomba/status", "cleaning");
+      printlnDebug("Started cleaning");
+    }, 100 },
+};
+
+const Step goToDockSteps[] = {
+  { roombaSafeMode, MODE_CHANGE_WAIT },
+  { []() {
+      roomba.coverAndDock(); // Send command to seek dock
+      client.publish("roomba/status", "dock");
+      printlnDebug("Going to dock");
+    }, 100 },
+};
+
+const Step stopSteps[] = {
+  { roombaStart, MODE_CHANGE_WAIT },
+  { []() { roomba.power(); }, 100 },
+  { []() {
+      client.publish("roomba/status", "power");
+      printlnDebug("Stopping roomba");
+    }, 0 },
+};
+
+// Arguments of the last parameterized command, read by its steps
+CommandArgs sequenceArgs;
+
+const Step spotSteps[] = {
+  { roombaSafeMode, MODE_CHANGE_WAIT },
+  { []() {
+      roomba.spot();
+      client.publish("roomba/status", "spot");
+      printlnDebug("Spot cleaning");
+    }, 100 },
+};
+
+const Step dockSteps[] = {
+  { roombaSafeMode, MODE_CHANGE_WAIT },
+  { []() {
+      roomba.dock();
+      client.publish("roomba/status", "dock");
+      printlnDebug("Seeking dock");
+    }, 100 },
+};
+
+const Step driveSteps[] = {
+  { roombaSafeMode, MODE_CHANGE_WAIT },
+  { []() { roomba.drive(sequenceArgs.values[0], sequenceArgs.values[1]); }, 0 },
+};
+
+const Step ledsSteps[] = {
+  { roombaSafeMode, MODE_CHANGE_WAIT },
+  { []() { roomba.leds(sequenceArgs.values[0], sequenceArgs.values[1], sequenceArgs.values[2]); }, 0 },
+};
+
+// Pattern of the last pattern command, read by its steps
+const Pattern* sequencePattern = NULL;
+
+// Only known once the roomba answered a script read back, the 500 and 600
+// series have no script commands and never do. They would take the bytes
+// of a script for commands, scripts are only sent once they are supported
+enum ScriptSupport {
+  ScriptsUnknown,
+  ScriptsSupported,
+  ScriptsMissing
+};
+
+ScriptSupport scriptSupport = ScriptsUnknown;
+// Uploaded and read back, NULL when no upload is in progress
+const Pattern* loadingPattern = NULL;
+// Length of the script, then the script
+uint8_t scriptReadBack[1 + MAX_SCRIPT_LENGTH];
+
+void onScriptReadBack(uint8_t packetId, bool ok);
+
+// While the support is unknown, only reads back what the roomba has
+bool requestScriptReadBack(){
+  if(scriptSupport == ScriptsSupported){
+    loadedPattern = NULL;
+    roomba.script_P(loadingPattern->script, loadingPattern->length);
+  }
+  return roomba.requestScript(scriptReadBack, sizeof(scriptReadBack), onScriptReadBack);
+}
+
+void onScriptReadBack(uint8_t packetId, bool ok){
+  (void) packetId;
+  if(scriptSupport == ScriptsUnknown){
+    scriptSupport = ok ? ScriptsSupported : ScriptsMissing;
+    // The stream is still paused, the upload follows right away
+    if(ok && requestScriptReadBack()){
+      return;
     }
   }
-  delay(100);
+  else if(ok && scriptMatches(*loadingPattern, scriptReadBack + 1, scriptReadBack[0])){
+    loadedPattern = loadingPattern;
+  }
+  loadingPattern = NULL;
+  if(STREAM_SENSORS){
+    resumeStream();
+  }
+}
+
+// False while the serial line is busy with another query, a poll or the
+// upload of a cancelled pattern
+bool startPatternLoad(){
+  if(loadingPattern != NULL){
+    return false;
+  }
+  if(STREAM_SENSORS ? !pauseStreamFor(requestScriptReadBack) : roomba.transactionPending()){
+    return false;
+  }
+  loadingPattern = sequencePattern;
+  if(!STREAM_SENSORS){
+    requestScriptReadBack();
+  }
+  return true;
 }
 
-unsigned long countSongTimeMs(uint8_t* song, uint8_t numNotes){
-  unsigned long songTimeMs = 0;
-  for(int i = 1; i < numNotes; i += 2){
-    songTimeMs = song[i] * 16; // 16 ms ~= 1/64s
+// Uploaded once, the script stays in the roomba until it reboots. The
+// upload ends on its own when the sequence is cancelled meanwhile
+void loadPattern(){
+  if(loadedPattern == sequencePattern){
+    roombaSequence.skipWait();
+    return;
   }
-  return songTimeMs;
+  if(scriptSupport != ScriptsMissing && !startPatternLoad()){
+    roombaSequence.retry();
+  }
+}
+
+void checkPattern(){
+  if(loadingPattern != NULL){
+    roombaSequence.retry();
+    return;
+  }
+  if(loadedPattern != sequencePattern){
+    publishDebug(scriptSupport == ScriptsMissing ? "Patterns need a roomba with scripts" : "Pattern upload failed");
+    roombaSequence.cancel();
+  }
+}
+
+const Step patternSteps[] = {
+  { loadPattern, 0 },
+  { checkPattern, 0 },
+  { roombaSafeMode, MODE_CHANGE_WAIT },
+  { []() {
+      roomba.playScript();
+      client.publish("roomba/status", sequencePattern->name);
+      printlnDebug("Playing pattern");
+    }, 0 },
+};
+
+// Teleoperation state, see teleopDrive()
+bool teleopDriving = false;
+unsigned long lastTeleop = 0;
+
+// Other commands take over the wheels, the deadman must not stop them
+void endTeleop(){
+  teleopDriving = false;
+}
+
+template<size_t N>
+void startSequence(const Step (&steps)[N]){
+  // A new command replaces the one in progress, e.g. power stops the music
+  endTeleop();
+  songPlayer.stop();
+  roombaSequence.start(steps, N);
+}
+
+template<size_t N>
+void startSequence(const Step (&steps)[N], const CommandArgs& args){
+  sequenceArgs = args;
+  startSequence(steps);
 }
 
 void playImperialMarch(){
-  // Notes taken from https://github.com/t0ph/ArduinoRoombaControl/blob/master/RoombaImperialMarch.ino
-  uint8_t a[] = { 55, 32, 55, 32, 55, 32, 51, 24, 58, 8, 55, 32, 51, 24, 58, 8, 55, 64 };
-  uint8_t b[] = { 62, 32, 62, 32, 62, 32, 63, 24, 58, 8, 54, 32, 51, 24, 58, 8, 55, 64 };
-  uint8_t c[] = { 3, 12, 67, 32, 55, 24, 55, 8, 67, 32, 66, 24, 65, 8, 64, 8, 63, 8, 64, 16, 30, 16, 56, 16, 61, 32 };
-  uint8_t d[] = { 4, 14, 60, 24, 59, 8, 58, 8, 57, 8, 58, 16, 10, 16, 52, 16, 54, 32, 51, 24, 58, 8, 55, 32, 51, 24, 58, 8, 55, 64 };
-  
-  roomba.start();
-  delay(50);  
-  // Load the song parts
-  roomba.song(1, a, sizeof(a));
-  delay(100);
-  roomba.song(2, b, sizeof(b));
-  delay(100);
-
-
-  roomba.fullMode();
-  delay(100);
-  // play the song
-  roomba.playSong(1);
-  //delay(countSongTimeMs(a, sizeof(a)));
-  delay(4000);
-
-  roomba.fullMode();
-  delay(100);
-  roomba.playSong(2);
-  //delay(countSongTimeMs(b, sizeof(b)));
-  delay(4000);
-
-  // Load 2 more songs, was not working loading them at the same time as the other
-  roomba.song(3, c, sizeof(c));
-  delay(100);
-  roomba.song(4, d, sizeof(d));
-  delay(100);
-
-  roomba.fullMode();
-  delay(100);
-
-  roomba.playSong(3);
-  //delay(countSongTimeMs(c, sizeof(c)));
-  delay(3300);
-
-  roomba.fullMode();
-  delay(100);
-  roomba.playSong(4);
-  //delay(countSongTimeMs(d, sizeof(d)));
-  delay(4000);
-  roomba.start();
+  endTeleop();
+  roombaSequence.cancel();
+  songPlayer.play(imperialMarch, sizeof(imperialMarch) / sizeof(imperialMarch[0]));
+}
+
+// Sequences and songs share the serial line with the polled sensors
+bool roombaBusy(){
+  return roombaSequence.busy() || songPlayer.busy();
+}
+
+void runPattern(const Pattern& pattern){
+  sequencePattern = &pattern;
+  startSequence(patternSteps);
 }
 
 void startCleaning(){
-  roomba.start();
-  delay(100);
-  roomba.safeMode(); // Probably only needed for series 600
-  delay(100);
-  roomba.cover(); // Sends clean command
-  client.publish("roomba/status", "cleaning");
-  printlnDebug("Started cleaning");
-  delay(100);
+  // The pose and map of a cleaning are relative to where it started
+  odometry.reset();
+  coverage.clear();
+  startSequence(startCleaningSteps);
 }
 
 void goToDock(){
-  roomba.start();
-  delay(100);
-  roomba.safeMode();
-  delay(100);
-  roomba.coverAndDock(); // Send command to seek dock
-  client.publish("roomba/status", "dock");
-  printlnDebug("Going to dock");
-  delay(100);
+  startSequence(goToDockSteps);
 }
 
 void stop() {
-  roomba.start();
-  delay(100);
-  roomba.power();
-  delay(100);
-  client.publish("roomba/status", "power");
-  printlnDebug("Stopping roomba");
+  startSequence(stopSteps);
+}
+
+bool inRange(int32_t value, int32_t min, int32_t max){
+  return value >= min && value <= max;
+}
+
+// drive <velocity mm/s> <radius mm>, radius 32768 drives straight,
+// -1 and 1 turn in place
+void driveCommand(const CommandArgs& args){
+  int32_t radius = args.values[1];
+  bool specialRadius = radius == 32768 || radius == -1 || radius == 1;
+  if(!inRange(args.values[0], -500, 500) || !(specialRadius || inRange(radius, -2000, 2000))){
+    publishDebug("Bad drive arguments");
+    return;
+  }
+  startSequence(driveSteps, args);
+}
+
+// leds <mask> <power colour> <power intensity>
+void ledsCommand(const CommandArgs& args){
+  for(uint8_t i = 0; i < args.count; i++){
+    if(!inRange(args.values[i], 0, 255)){
+      publishDebug("Bad leds arguments");
+      return;
+    }
+  }
+  startSequence(ledsSteps, args);
+}
+
+// The restart command is QoS 1 in a persistent session, PubSubClient
+// acknowledges it after the callback. Restarting from there, it would be
+// sent again on every reconnection
+bool restartRequested = false;
+unsigned long restartRequestedAt = 0;
+
+void requestRestart(){
+  restartRequested = true;
+  restartRequestedAt = millis();
+}
+
+const Command commands[] = {
+  COMMAND("start", 0, 0, [](const CommandArgs&) { startCleaning(); }),
+  COMMAND("stop", 0, 0, [](const CommandArgs&) { goToDock(); }),
+  COMMAND("power", 0, 0, [](const CommandArgs&) { stop(); }),
+  COMMAND("imperial", 0, 0, [](const CommandArgs&) { playImperialMarch(); }),
+  COMMAND("restart", 0, 0, [](const CommandArgs&) { requestRestart(); }),
+  COMMAND("spot", 0, 0, [](const CommandArgs&) { startSequence(spotSteps); }),
+  COMMAND("dock", 0, 0, [](const CommandArgs&) { startSequence(dockSteps); }),
+  COMMAND("drive", 2, 2, driveCommand),
+  COMMAND("leds", 3, 3, ledsCommand),
+  COMMAND("map", 0, 0, [](const CommandArgs&) { publishCoverage(); }),
+  COMMAND("backoff", 0, 0, [](const CommandArgs&) { runPattern(backoffPattern); }),
+  COMMAND("spiral", 0, 0, [](const CommandArgs&) { runPattern(spiralPattern); }),
+  COMMAND("square", 0, 0, [](const CommandArgs&) { runPattern(squarePattern); }),
+};
+
+// Teleoperation, roomba/drive carries the left and right wheel speeds in
+// mm/s as 2 little-endian int16. Speeds are sent as soon as they arrive
+const int16_t MAX_WHEEL_SPEED = 500;
+
+int16_t wheelSpeed(const uint8_t* data){
+  int16_t speed = data[0] | (data[1] << 8);
+  return constrain(speed, -MAX_WHEEL_SPEED, MAX_WHEEL_SPEED);
+}
+
+void teleopDrive(const uint8_t* payload, unsigned int length){
+  if(length != 4){
+    publishDebug("Bad drive payload");
+    return;
+  }
+  if(!teleopDriving){
+    roombaSequence.cancel();
+    songPlayer.stop();
+  }
+  // Only sent when the mode changed, e.g. after a wheel drop. Back to
+  // back with the speeds, the roomba runs them in order on its next tick
+  roomba.ensureMode(Roomba::ModeSafe);
+  roomba.driveDirect(wheelSpeed(payload), wheelSpeed(payload + 2));
+  teleopDriving = true;
+  lastTeleop = millis();
+}
+
+void checkTeleopDeadman(){
+  if(teleopDriving && millis() - lastTeleop > TELEOP_DEADMAN){
+    roomba.driveDirect(0, 0);
+    teleopDriving = false;
+  }
 }
 
 void callback(char* topic, byte* payload, unsigned int length) {
   printlnDebug("Received MQTT message");
+  printlnDebug(topic);
 
-  String topicStr = String(topic);
-  String payloadStr = String();
-  
+  if(strcmp(topic, "roomba/drive") == 0) {
+    teleopDrive(payload, length);
+  }
+  else if(strcmp(topic, "roomba/commands") == 0) {
+    CommandResult result = dispatchCommand(commands, payload, length);
+    if(result == CommandUnknown){
+      publishDebug("Unknown command");
+    }
+    else if(result == CommandBadArgs){
+      publishDebug("Bad command arguments");
+    }
+  }
+}
 
-  payloadStr.reserve(length);
-  for(unsigned int i = 0; i < length; i++){
-    payloadStr += (char) payload[i];
+size_t formatVolts(char* buffer, int32_t millivolts){
+  return formatFixed(buffer, (millivolts + 5) / 10, 2); // Rounded to 2 decimals
+}
+
+// Each value is published when it moved by more than its deadband, and
+// at least once per heartbeat
+struct TelemetryMetric {
+  const char* topic;
+  int32_t (*read)();
+  size_t (*format)(char* buffer, int32_t value);
+  MetricFilter filter;
+  // Comes from the coulomb counter, held back until batteryReceived
+  bool estimated;
+};
+
+TelemetryMetric telemetryMetrics[] = {
+  { "roomba/battery/percentage", []() -> int32_t { return battPercentage; }, formatInt,
+    MetricFilter(0, TELEMETRY_HEARTBEAT), true },
+  { "roomba/battery/capacity", []() -> int32_t { return battCappacity; }, formatInt,
+    MetricFilter(0, TELEMETRY_HEARTBEAT), true },
+  { "roomba/battery/charge", []() -> int32_t { return battCharge; }, formatInt,
+    MetricFilter(10, TELEMETRY_HEARTBEAT), true }, // mAh
+  { "roomba/battery/voltage", []() -> int32_t { return battVoltageMV; }, formatVolts,
+    MetricFilter(50, TELEMETRY_HEARTBEAT), false }, // mV
+  { "roomba/battery/current", []() -> int32_t { return battCurrent; }, formatInt,
+    MetricFilter(100, TELEMETRY_HEARTBEAT), false }, // mA
+  { "roomba/charge", []() -> int32_t { return chargingState; }, formatInt,
+    MetricFilter(0, TELEMETRY_HEARTBEAT), false },
+  { "roomba/battery/empty", []() -> int32_t { return batteryCounter.minutesToEmpty(); }, formatInt,
+    MetricFilter(5, TELEMETRY_HEARTBEAT), true }, // minutes, -1 when not discharging
+  { "roomba/battery/full", []() -> int32_t { return batteryCounter.minutesToFull(); }, formatInt,
+    MetricFilter(5, TELEMETRY_HEARTBEAT), true }, // minutes, -1 when not charging
+};
+
+// Publishes everything on the next sendMqttInfo()
+void invalidateTelemetry(){
+  for(TelemetryMetric& metric : telemetryMetrics){
+    metric.filter.invalidate();
   }
+}
 
-  printlnDebug("Topic : " + topicStr);
-  printlnDebug("Payload : " + payloadStr);
+TelemetrySample currentTelemetry(){
+  TelemetrySample sample;
+  sample.chargingState = chargingState;
+  sample.percentage = battPercentage;
+  sample.capacity = battCappacity;
+  sample.charge = battCharge;
+  sample.voltage = battVoltageMV;
+  sample.current = battCurrent;
+  // Over 22 days is as good as never
+  int32_t toEmpty = batteryCounter.minutesToEmpty();
+  int32_t toFull = batteryCounter.minutesToFull();
+  sample.minutesToEmpty = constrain(toEmpty, -1, INT16_MAX);
+  sample.minutesToFull = constrain(toFull, -1, INT16_MAX);
+  return sample;
+}
 
-  // client.publish("roomba/debug", payloadStr.c_str());
+bool publishTelemetryFrame(){
+  uint8_t frame[TELEMETRY_FRAME_SIZE];
+  size_t length = encodeTelemetryFrame(currentTelemetry(), frame);
+  return client.publish("roomba/telemetry", frame, length);
+}
 
-  if(topicStr == "roomba/commands") {
-    if(payloadStr == "start") {
-      startCleaning();
-    } 
-    else if (payloadStr == "stop") { 
-      goToDock();
+// {"n":667,"current":[min,mean,max],"voltage":[min,mean,max]} in mA and mV
+void publishBatteryStats(){
+  char payload[128];
+  TextBuffer text(payload, sizeof(payload));
+  text.add("{\"n\":").addInt(currentStats.count());
+  text.add(",\"current\":[").addInt(currentStats.min()).add(",").addInt(currentStats.mean())
+      .add(",").addInt(currentStats.max()).add("]");
+  text.add(",\"voltage\":[").addInt(voltageStats.min()).add(",").addInt(voltageStats.mean())
+      .add(",").addInt(voltageStats.max()).add("]}");
+  if(client.publish("roomba/battery/stats", payload)){
+    currentStats.reset();
+    voltageStats.reset();
+  }
+}
+
+int32_t publishedX = 0;
+int32_t publishedY = 0;
+int16_t publishedHeading = -1;
+
+// {"x":1250,"y":-310,"heading":90} in mm and degrees
+void publishPose(){
+  int32_t x = odometry.xMm();
+  int32_t y = odometry.yMm();
+  int16_t heading = odometry.headingDeg();
+  if(x == publishedX && y == publishedY && heading == publishedHeading){
+    return;
+  }
+  char payload[64];
+  TextBuffer text(payload, sizeof(payload));
+  text.add("{\"x\":").addInt(x).add(",\"y\":").addInt(y);
+  text.add(",\"heading\":").addInt(heading).add("}");
+  if(client.publish("roomba/pose", payload)){
+    publishedX = x;
+    publishedY = y;
+    publishedHeading = heading;
+  }
+}
+
+TimedSample offlineBuffer[OFFLINE_SAMPLES];
+SampleRing offlineSamples(offlineBuffer, OFFLINE_SAMPLES);
+Periodic offlineSampleTimer(TIME_BETWEEN_OFFLINE_SAMPLES);
+
+void bufferOfflineSample(unsigned long now){
+  // Before the first NTP sync the epoch counts from 1970, a sample without
+  // its time of the day is useless in the graphs
+  if(!batteryReceived || !timeClient.isTimeSet() || !offlineSampleTimer.due(now)){
+    return;
+  }
+  // NTPClient applies the local offset, the backlog is in UTC
+  offlineSamples.push(timeClient.getEpochTime() - utcOffsetInSeconds, currentTelemetry());
+}
+
+// Sends the oldest samples of the backlog as one message of records
+void publishBacklogBatch(){
+  uint16_t count = offlineSamples.size();
+  if(count > BACKLOG_BATCH_SAMPLES){
+    count = BACKLOG_BATCH_SAMPLES;
+  }
+  if(!client.beginPublish("roomba/telemetry/backlog", count * TELEMETRY_RECORD_SIZE, false)){
+    return;
+  }
+  for(uint16_t i = 0; i < count; i++){
+    uint8_t record[TELEMETRY_RECORD_SIZE];
+    encodeTelemetryRecord(offlineSamples.at(i), record);
+    if(client.write(record, sizeof(record)) != sizeof(record)){
+      return;
+    }
+  }
+  // endPublish() of PubSubClient 2.8 always succeeds and the message may
+  // still wait in bufferedClient, the records are only dropped once the
+  // socket took all of them
+  client.endPublish();
+  if(bufferedClient.push()){
+    offlineSamples.drop(count);
+  }
+}
+
+void sendMqttInfo(){
+  unsigned long now = millis();
+  bool due = false;
+  uint8_t sent = 0;
+
+  if(!client.connected()){
+    bufferOfflineSample(now);
+    return;
+  }
+
+  // Until the first anchor the estimates read 0, they are left unpublished
+  // rather than graphed as an empty battery
+  for(TelemetryMetric& metric : telemetryMetrics){
+    if(metric.estimated && !batteryReceived){
+      continue;
+    }
+    due |= metric.filter.shouldPublish(metric.read(), now);
+  }
+  if(!due){
+    return;
+  }
+
+  // The frame carries every value, it is sent when any of them is due and
+  // once they are all known
+  bool frameSent = PUBLISH_TELEMETRY_FRAME && batteryReceived && publishTelemetryFrame();
+  if(frameSent){
+    sent++;
+  }
+
+  for(TelemetryMetric& metric : telemetryMetrics){
+    if(metric.estimated && !batteryReceived){
+      continue;
     }
-    else if(payloadStr == "power") {
-      stop();
+    int32_t value = metric.read();
+    if(!PUBLISH_TELEMETRY_TOPICS){
+      if(frameSent){
+        metric.filter.published(value, now);
+      }
+      continue;
     }
-    else if(payloadStr == "imperial") {
-      playImperialMarch();
+    if(!metric.filter.shouldPublish(value, now)){
+      continue;
     }
-    else if (payloadStr == "restart"){
-      ESP.restart();
+    // No String nor heap, see test/test_heap
+    char text[FIXED_BUFFER_SIZE];
+    metric.format(text, value);
+
+    if(client.publish(metric.topic, text)){
+      metric.filter.published(value, now);
+      sent++;
     }
   }
+
+  if(sent > 0){
+    printlnDebug("Sent MQTT data");
+  }
 }
 
-void sendMqttInfo(){
-  client.publish("roomba/battery/percentage", String((int) battPercentage).c_str());
-  client.publish("roomba/battery/capacity", String(battCappacity).c_str());
-  client.publish("roomba/battery/charge", String(battCharge).c_str());
-  client.publish("roomba/battery/voltage", String(battVoltage).c_str());
-  client.publish("roomba/battery/current", String(battCurrent).c_str());
-  client.publish("roomba/charge", String(chargingState).c_str());
-  printlnDebug("Sent MQTT data");
+// Charge and capacity correct the coulomb counter now and then, sooner
+// when the last read failed
+unsigned long anchorStartedAt = 0;
+bool anchorAttempted = false;
+
+bool anchorDue(unsigned long now){
+  unsigned long interval = batteryCounter.anchored() ? TIME_BETWEEN_BATTERY_ANCHORS : BATTERY_ANCHOR_RETRY;
+  return !anchorAttempted || now - anchorStartedAt >= interval;
+}
+
+void startAnchor(unsigned long now){
+  anchorAttempted = true;
+  anchorStartedAt = now;
+}
+
+// The ranges drop the super big values the roomba sometimes sends
+void applyAnchorReadings(){
+  if(readings.has(Roomba::SensorBatteryCharge) && readings.has(Roomba::SensorBatteryCapacity)){
+    batteryCounter.anchor(readings.value(Roomba::SensorBatteryCharge),
+                          readings.value(Roomba::SensorBatteryCapacity));
+    updateBatteryEstimate();
+  }
+}
+
+// Battery and OI mode, asked with a query list from loop(). The charge
+// and capacity are added when an anchor is due
+const SensorSet POLLED_SENSORS = BATTERY_SENSORS | MODE_SENSORS;
+SensorPlan<POLLED_SENSORS> pollPlan;
+SensorPlan<POLLED_SENSORS | ANCHOR_SENSORS> anchoredPollPlan;
+const uint8_t* polledPackets = pollPlan.packets;
+uint8_t polledCount = 0;
+// Data of the packets without their ids
+uint8_t polledReply[anchoredPollPlan.REPLY_SIZE];
+
+// Runs from pollTransaction() in the roomba stage, outside the batch of
+// the telemetry stage
+uint8_t pollTimeouts = 0;
+
+void onBatterySensors(uint8_t packetId, bool ok){
+  WriteBatch batch(bufferedClient);
+  if(ok){
+    pollTimeouts = 0;
+    readings.clear();
+    readings.decodeReply(polledPackets, polledCount, polledReply, sizeof(polledReply));
+    reportRejectedSensors();
+    applyAnchorReadings();
+    applyBatteryReadings();
+    if(readings.has(Roomba::SensorOIMode)){
+      roomba.modeObserved(readings.value(Roomba::SensorOIMode));
+    }
+    printlnDebug("Updated sensors");
+  }
+  else {
+    publishSensorError("Sensor timeouts", roomba.transactionStats(packetId).timeouts);
+    // A rebooted roomba ignores the polls until the OI is started
+    if(++pollTimeouts >= MAX_POLL_TIMEOUTS){
+      pollTimeouts = 0;
+      restartRoombaOI();
+      printlnDebug("Restarted roomba OI");
+    }
+  }
+  sendMqttInfo();
 }
 
 void updateAllRoombaSensors(){
-  updateBatteryCharge();
-  updateChargingState();
-  updateVoltageCurrent();
-  printlnDebug("Updated sensors");
+  unsigned long now = millis();
+  bool anchor = anchorDue(now);
+  uint8_t* packets = anchor ? anchoredPollPlan.packets : pollPlan.packets;
+  uint8_t count = anchor ? anchoredPollPlan.COUNT : pollPlan.COUNT;
+  uint8_t length = anchor ? anchoredPollPlan.REPLY_SIZE : pollPlan.REPLY_SIZE;
+  // One query list for the planned packets instead of one per value.
+  // Returns right away, the reply is collected by pollTransaction()
+  // and published by onBatterySensors()
+  if(roomba.requestSensorsList(packets, count, polledReply, length, onBatterySensors)){
+    polledPackets = packets;
+    polledCount = count;
+    if(anchor){
+      startAnchor(now);
+    }
+  }
+}
+
+// When streaming, the charge and capacity are a stream query
+SensorPlan<ANCHOR_SENSORS> anchorPlan;
+uint8_t anchorReply[anchorPlan.REPLY_SIZE];
+
+void onAnchorSensors(uint8_t packetId, bool ok){
+  if(ok){
+    readings.clear();
+    readings.decodeReply(anchorPlan.packets, anchorPlan.COUNT, anchorReply, sizeof(anchorReply));
+    reportRejectedSensors();
+    applyAnchorReadings();
+  }
+  else {
+    publishSensorError("Sensor timeouts", roomba.transactionStats(packetId).timeouts);
+  }
+  resumeStream();
+}
+
+bool requestAnchor(){
+  return roomba.requestSensorsList(anchorPlan.packets, anchorPlan.COUNT, anchorReply, sizeof(anchorReply),
+                                   onAnchorSensors);
+}
+
+void startStreamAnchor(){
+  unsigned long now = millis();
+  // Commands and scripts also use the serial line
+  if(roombaBusy() || !anchorDue(now) || !pauseStreamFor(requestAnchor)){
+    return;
+  }
+  startAnchor(now);
+}
+
+enum LoopStage {
+  StageConnection,
+  StageOta,
+  StageNtp,
+  StageMqtt,
+  StageRoomba,
+  StageTelemetry,
+  StageLoop,
+  STAGE_COUNT
+};
+
+const char* const STAGE_TOPICS[STAGE_COUNT] = {
+  "roomba/metrics/connection",
+  "roomba/metrics/ota",
+  "roomba/metrics/ntp",
+  "roomba/metrics/mqtt",
+  "roomba/metrics/roomba",
+  "roomba/metrics/telemetry",
+  "roomba/metrics/loop",
+};
+
+StageMetrics loopMetrics[LOOP_METRICS ? STAGE_COUNT : 1];
+
+// NULL when disabled, StageTimer then measures nothing
+StageMetrics* stageMetrics(LoopStage stage){
+  return LOOP_METRICS ? &loopMetrics[stage] : NULL;
+}
+
+// Counters of the stream parser since the last publication
+void publishStreamStats(){
+  const StreamStats& stats = streamParser.stats();
+  char payload[128];
+  TextBuffer text(payload, sizeof(payload));
+  text.add("{\"frames\":").addInt(stats.frames)
+    .add(",\"checksum\":").addInt(stats.checksumErrors)
+    .add(",\"malformed\":").addInt(stats.malformed)
+    .add(",\"resyncs\":").addInt(stats.resyncs)
+    .add(",\"discarded\":").addInt(stats.discarded)
+    .add(",\"overruns\":").addInt(stats.overruns).add("}");
+  client.publish("roomba/metrics/stream", payload);
+  streamParser.resetStats();
+}
+
+void publishLoopMetrics(){
+  WriteBatch batch(bufferedClient);
+  for(uint8_t stage = 0; stage < STAGE_COUNT; stage++){
+    char payload[96];
+    loopMetrics[stage].format(payload, sizeof(payload));
+    // A failed publish keeps its window, the next one covers both
+    if(client.publish(STAGE_TOPICS[stage], payload)){
+      loopMetrics[stage].reset();
+    }
+  }
+  if(STREAM_SENSORS){
+    publishStreamStats();
+  }
 }
 
+Periodic mqttUpdateTimer(TIME_BETWEEN_MQTT_UPDATE);
+Periodic telemetryTimer(TIME_BETWEEN_TELEMETRY_CHECK);
+Periodic metricsTimer(TIME_BETWEEN_METRICS);
+Periodic backlogTimer(TIME_BETWEEN_BACKLOG_BATCHES);
+Periodic batteryStatsTimer(TIME_BETWEEN_BATTERY_STATS);
+Periodic poseTimer(TIME_BETWEEN_POSE);
+
 void setup() {
   printlnDebug("ESP started");
   pinMode(LED, OUTPUT);
   
-  // Connect to wifi
+  // Connect to wifi, loop() carries on with OTA and MQTT once it is up
   WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
   WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
 
-  restartIfWifiIsDiconnected();
-
-  printDebug("WiFi connected\nIP : ");
-  printlnDebug(WiFi.localIP());
-
-  setupOTA();
-
   // Setup MQTT client
+  setupClientId();
   client.setServer(MQTT_HOST, 1883);
   client.setCallback(callback);
-  restartIfClientDisconnected();
-  printlnDebug("MQTT connected"); 
-  client.publish("online", "roombaEsp8266"); // Send on boot that we are online, mostly for debugging
-  delay(50);
+  client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+  // Small packets go out at once, the ones of a burst are already gathered
+  // by bufferedClient and Nagle would only hold back the last segment
+  wifiClient.setNoDelay(true);
 
   roomba.start();
+  if(STREAM_SENSORS){
+    startSensorStream();
+  }
+  // First histograms cover a full interval, not just the boot
+  metricsTimer.reset(millis());
 
   printlnDebug("End of setup");
 }
 
 void loop() {
-  
-  static unsigned long lastMqttUpdate = 0;
+  StageTimer loopTimer(stageMetrics(StageLoop));
 
-  restartIfWifiIsDiconnected();
-  restartIfClientDisconnected();
+  {
+    StageTimer timer(stageMetrics(StageConnection));
+    maintainConnection();
+  }
 
-  ArduinoOTA.handle();
+  {
+    StageTimer timer(stageMetrics(StageOta));
+    if(otaStarted){
+      ArduinoOTA.handle();
+    }
+  }
 
-  timeClient.update();
+  {
+    StageTimer timer(stageMetrics(StageNtp));
+    // An update waits up to 1 s for the reply and is tried again on every
+    // call until it succeeds, offline it would stall each loop()
+    if(connectionState == ConnectionUp){
+      timeClient.update();
+    }
+  }
 
-  client.loop();
+  {
+    StageTimer timer(stageMetrics(StageMqtt));
+    client.loop();
+  }
 
-  if(millis() - lastMqttUpdate > TIME_BETWEEN_MQTT_UPDATE) {
-    /* TODO : add logic to keep the update delay the same, but 
-     * update each sensor at different times to no block the main loop
-     * for too long. */
-    updateAllRoombaSensors();
-    sendMqttInfo();
-    lastMqttUpdate = millis();
+  if(restartRequested && millis() - restartRequestedAt >= RESTART_DELAY){
+    ESP.restart();
+  }
+
+  {
+    StageTimer timer(stageMetrics(StageRoomba));
+    roombaSequence.run(millis());
+    songPlayer.run(millis());
+    checkTeleopDeadman();
+
+    if(STREAM_SENSORS){
+      // The stream is paused while a query is read
+      if(streamQueryState == QueryReading){
+        roomba.pollTransaction();
+      }
+      else {
+        pollSensorStream();
+      }
+      startStreamAnchor();
+      runStreamQuery();
+    }
+    else {
+      roomba.pollTransaction();
+    }
+  }
+
+  {
+    StageTimer timer(stageMetrics(StageTelemetry));
+    // Everything published by this stage leaves in one write at its end
+    WriteBatch batch(bufferedClient);
+    if(STREAM_SENSORS){
+      // Streamed values are always fresh, publish changes as they come
+      if(telemetryTimer.due(millis())){
+        sendMqttInfo();
+      }
+    }
+    else if(mqttUpdateTimer.due(millis())) {
+      // Polled sensors share the serial line with the commands, don't
+      // interleave them with a sequence in progress
+      if(!roombaBusy()){
+        updateAllRoombaSensors();
+      }
+      else {
+        sendMqttInfo();
+      }
+    }
+
+    if(PUBLISH_BATTERY_STATS && batteryStatsTimer.due(millis()) && currentStats.count() > 0){
+      publishBatteryStats();
+    }
+
+    if(PUBLISH_POSE && STREAM_SENSORS && poseTimer.due(millis())){
+      publishPose();
+    }
+
+    // Spread the backlog so live messages still go through
+    if(offlineSamples.size() > 0 && client.connected() && backlogTimer.due(millis())){
+      publishBacklogBatch();
+    }
+  }
+
+  if(LOOP_METRICS && metricsTimer.due(millis())){
+    publishLoopMetrics();
   }
-  
 }
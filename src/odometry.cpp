@@ -0,0 +1,84 @@
+#include "odometry.h"
+
+const uint8_t SINE_SHIFT = 14;
+
+// sin(i / 2 degrees) * 2^14 for i = 0 to 180
+const int16_t QUARTER_SINE[181] PROGMEM = {
+  0, 143, 286, 429, 572, 715, 857, 1000, 1143, 1285, 1428, 1570,
+  1713, 1855, 1997, 2139, 2280, 2422, 2563, 2704, 2845, 2986, 3126, 3266,
+  3406, 3546, 3686, 3825, 3964, 4102, 4240, 4378, 4516, 4653, 4790, 4927,
+  5063, 5199, 5334, 5469, 5604, 5738, 5872, 6005, 6138, 6270, 6402, 6533,
+  6664, 6794, 6924, 7053, 7182, 7311, 7438, 7565, 7692, 7818, 7943, 8068,
+  8192, 8316, 8438, 8561, 8682, 8803, 8923, 9043, 9162, 9280, 9397, 9514,
+  9630, 9746, 9860, 9974, 10087, 10199, 10311, 10422, 10531, 10641, 10749, 10856,
+  10963, 11069, 11174, 11278, 11381, 11484, 11585, 11686, 11786, 11885, 11982, 12080,
+  12176, 12271, 12365, 12458, 12551, 12642, 12733, 12822, 12911, 12998, 13085, 13170,
+  13255, 13338, 13421, 13502, 13583, 13662, 13741, 13818, 13894, 13970, 14044, 14117,
+  14189, 14260, 14330, 14399, 14466, 14533, 14598, 14663, 14726, 14788, 14849, 14909,
+  14968, 15025, 15082, 15137, 15191, 15244, 15296, 15346, 15396, 15444, 15491, 15537,
+  15582, 15626, 15668, 15709, 15749, 15788, 15826, 15862, 15897, 15931, 15964, 15996,
+  16026, 16055, 16083, 16110, 16135, 16159, 16182, 16204, 16225, 16244, 16262, 16279,
+  16294, 16309, 16322, 16333, 16344, 16353, 16362, 16368, 16374, 16378, 16382, 16383,
+  16384,
+};
+
+// Sine of an angle in half degrees, any value
+static int32_t sineHalfDeg(int32_t angle){
+  angle %= 720;
+  if(angle < 0){
+    angle += 720;
+  }
+  int32_t sign = 1;
+  if(angle >= 360){
+    angle -= 360;
+    sign = -1;
+  }
+  if(angle > 180){
+    angle = 360 - angle;
+  }
+  return sign * (int16_t) pgm_read_word(&QUARTER_SINE[angle]);
+}
+
+static int32_t cosineHalfDeg(int32_t angle){
+  return sineHalfDeg(angle + 180);
+}
+
+// Rounded to the nearest mm
+static int32_t toMm(int32_t value){
+  const int32_t half = 1 << (SINE_SHIFT - 1);
+  return value >= 0 ? (value + half) >> SINE_SHIFT : -((-value + half) >> SINE_SHIFT);
+}
+
+Odometry::Odometry(){
+  reset();
+}
+
+void Odometry::update(int16_t distanceMm, int16_t angleDeg){
+  int32_t middle = 2 * _heading + angleDeg;
+  _x += distanceMm * cosineHalfDeg(middle);
+  _y += distanceMm * sineHalfDeg(middle);
+
+  int32_t heading = (_heading + angleDeg) % 360;
+  _heading = heading < 0 ? heading + 360 : heading;
+}
+
+void Odometry::reset(){
+  _x = 0;
+  _y = 0;
+  _heading = 0;
+}
+
+int32_t Odometry::xMm() const {
+  return toMm(_x);
+}
+
+int32_t Odometry::yMm() const {
+  return toMm(_y);
+}
+
+void Odometry::project(int32_t forwardMm, int32_t leftMm, int32_t& xMm, int32_t& yMm) const {
+  int32_t cosine = cosineHalfDeg(2 * _heading);
+  int32_t sine = sineHalfDeg(2 * _heading);
+  xMm = toMm(_x + forwardMm * cosine - leftMm * sine);
+  yMm = toMm(_y + forwardMm * sine + leftMm * cosine);
+}
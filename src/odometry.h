@@ -0,0 +1,36 @@
+#ifndef ODOMETRY_H
+#define ODOMETRY_H
+
+#include <Arduino.h>
+
+/* Dead reckoning from the distance (packet 19, mm) and angle (packet 20,
+ * degrees counter clockwise) the roomba reports since its previous frame.
+ * Integer math only : the heading is kept in whole degrees like the OI
+ * reports it, and each step is projected on the heading at its middle
+ * with a half degree sine table. x and y accumulate in 1/16384 mm so the
+ * steps add up without rounding, good for +-131 m. */
+class Odometry {
+public:
+  Odometry();
+
+  void update(int16_t distanceMm, int16_t angleDeg);
+
+  // Back to x = y = 0 facing heading 0
+  void reset();
+
+  int32_t xMm() const;
+  int32_t yMm() const;
+
+  // Position in mm of a point given relative to the robot, forward along
+  // its heading and to its left, e.g. where a bump happened
+  void project(int32_t forwardMm, int32_t leftMm, int32_t& xMm, int32_t& yMm) const;
+  // 0 to 359
+  int16_t headingDeg() const { return _heading; }
+
+private:
+  int32_t _x;
+  int32_t _y;
+  int16_t _heading;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#include "patterns.h"
+
+bool scriptMatches(const Pattern& pattern, const uint8_t* data, uint8_t length){
+  if(length != pattern.length){
+    return false;
+  }
+  for(uint8_t i = 0; i < length; i++){
+    if(data[i] != pgm_read_byte(pattern.script + i)){
+      return false;
+    }
+  }
+  return true;
+}
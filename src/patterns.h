@@ -0,0 +1,64 @@
+#ifndef PATTERNS_H
+#define PATTERNS_H
+
+#include <Arduino.h>
+
+/* Motion patterns run by the roomba itself as an OI script. The moves and
+ * their waits are timed by the robot, a wifi hiccup can't stretch a turn.
+ * The roomba keeps a single script of up to 100 bytes, it doesn't react
+ * to other commands while it waits on a step of it.
+ *
+ * Scripts are byte arrays in PROGMEM written with the SCRIPT_ macros and
+ * checked at compile time with makePattern() :
+ *   constexpr uint8_t turnScript[] PROGMEM = {
+ *     SCRIPT_DRIVE(200, SCRIPT_TURN_LEFT), SCRIPT_WAIT_ANGLE(90), SCRIPT_STOP
+ *   };
+ *   constexpr Pattern turn = makePattern("turn", turnScript); */
+
+const uint8_t MAX_SCRIPT_LENGTH = 100;
+
+// Special radius of SCRIPT_DRIVE()
+const int32_t SCRIPT_STRAIGHT = 32768;
+const int32_t SCRIPT_TURN_LEFT = 1;
+const int32_t SCRIPT_TURN_RIGHT = -1;
+
+// Script arguments are big-endian, 32768 is sent as 0x8000
+constexpr uint8_t scriptHighByte(int32_t value){
+  return ((uint32_t) value >> 8) & 0xff;
+}
+
+constexpr uint8_t scriptLowByte(int32_t value){
+  return (uint32_t) value & 0xff;
+}
+
+#define SCRIPT_WORD(value) scriptHighByte(value), scriptLowByte(value)
+
+// mm/s and mm, see Roomba::drive()
+#define SCRIPT_DRIVE(velocity, radius) 137, SCRIPT_WORD(velocity), SCRIPT_WORD(radius)
+#define SCRIPT_DRIVE_DIRECT(right, left) 145, SCRIPT_WORD(right), SCRIPT_WORD(left)
+#define SCRIPT_STOP SCRIPT_DRIVE_DIRECT(0, 0)
+// Tenths of a second
+#define SCRIPT_WAIT_TIME(tenths) 155, (tenths)
+// Negative when driving backward
+#define SCRIPT_WAIT_DISTANCE(mm) 156, SCRIPT_WORD(mm)
+// Positive counter clockwise
+#define SCRIPT_WAIT_ANGLE(degrees) 157, SCRIPT_WORD(degrees)
+// One of Roomba::EventType, inverted by 255 - event
+#define SCRIPT_WAIT_EVENT(event) 158, (event)
+
+struct Pattern {
+  const char* name;
+  const uint8_t* script; // PROGMEM
+  uint8_t length;
+};
+
+template<size_t N>
+constexpr Pattern makePattern(const char* name, const uint8_t (&script)[N]){
+  static_assert(N <= MAX_SCRIPT_LENGTH, "An OI script holds at most 100 bytes");
+  return Pattern{ name, script, N };
+}
+
+// True when data, as read back with Roomba::requestScript(), is the script
+bool scriptMatches(const Pattern& pattern, const uint8_t* data, uint8_t length);
+
+#endif
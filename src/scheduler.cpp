@@ -0,0 +1,87 @@
+#include "scheduler.h"
+
+Periodic::Periodic(unsigned long intervalMs)
+  : _interval(intervalMs), _last(0), _fired(false) {
+}
+
+bool Periodic::due(unsigned long now){
+  if(_fired && now - _last < _interval){
+    return false;
+  }
+  _last = now;
+  _fired = true;
+  return true;
+}
+
+void Periodic::reset(unsigned long now){
+  _last = now;
+  _fired = true;
+}
+
+Backoff::Backoff(unsigned long minMs, unsigned long maxMs)
+  : _min(minMs), _max(maxMs), _delay(minMs), _last(0), _wait(0) {
+}
+
+bool Backoff::due(unsigned long now) const {
+  return now - _last >= _wait;
+}
+
+void Backoff::failed(unsigned long now){
+  _last = now;
+  _wait = _delay / 2 + random(_delay / 2 + 1);
+  _delay = _delay > _max / 2 ? _max : _delay * 2;
+}
+
+void Backoff::succeeded(){
+  _delay = _min;
+  _wait = 0;
+}
+
+Sequence::Sequence()
+  : _steps(NULL), _count(0), _next(0), _waitStart(0), _wait(0) {
+}
+
+void Sequence::start(const Step* steps, uint8_t count){
+  _steps = steps;
+  _count = count;
+  _next = 0;
+  _wait = 0;
+}
+
+void Sequence::cancel(){
+  _steps = NULL;
+  _count = 0;
+  _next = 0;
+}
+
+void Sequence::skipWait(){
+  _wait = 0;
+}
+
+void Sequence::retry(){
+  if(_next > 0){
+    _next--;
+  }
+  _wait = 0;
+}
+
+bool Sequence::busy() const {
+  return _steps != NULL;
+}
+
+void Sequence::run(unsigned long now){
+  if(_steps == NULL || now - _waitStart < _wait){
+    return;
+  }
+  if(_next >= _count){
+    // Wait after the last step is over
+    cancel();
+    return;
+  }
+  const Step& step = _steps[_next++];
+  _waitStart = now;
+  _wait = step.waitMs;
+  if(step.action != NULL){
+    step.action();
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+/* Small cooperative scheduler used from loop() instead of delay().
+ * Everything is polled with the current millis() and returns right away,
+ * so the wifi, mqtt and OTA stacks keep being serviced. All the time
+ * comparisons are done on differences to survive millis() overflow. */
+
+// Fires once every interval
+class Periodic {
+public:
+  explicit Periodic(unsigned long intervalMs);
+
+  // Returns true once the interval elapsed since the last time it fired
+  bool due(unsigned long now);
+
+  // Restarts the interval from now
+  void reset(unsigned long now);
+
+private:
+  unsigned long _interval;
+  unsigned long _last;
+  bool _fired;
+};
+
+// Waits between attempts that may fail, doubling up to a max after each
+// failure. The wait is randomized between half and all of it so devices
+// that lost the same broker don't all retry at the same time.
+class Backoff {
+public:
+  Backoff(unsigned long minMs, unsigned long maxMs);
+
+  // True when the next attempt may run
+  bool due(unsigned long now) const;
+
+  void failed(unsigned long now);
+
+  // The next failure waits the min again
+  void succeeded();
+
+private:
+  unsigned long _min;
+  unsigned long _max;
+  unsigned long _delay;
+  unsigned long _last;
+  unsigned long _wait;
+};
+
+typedef void (*StepAction)();
+
+// One action of a sequence and the time to wait before the next one
+struct Step {
+  StepAction action;
+  unsigned long waitMs;
+};
+
+// Runs a list of steps separated by waits, one step at a time
+class Sequence {
+public:
+  Sequence();
+
+  // Replaces whatever was running, the first step runs on the next run()
+  void start(const Step* steps, uint8_t count);
+  void cancel();
+
+  // Called from an action that had nothing to do, the next step runs
+  // on the next run() instead of after the wait
+  void skipWait();
+
+  // Called from an action that can't run yet, e.g. the serial line is
+  // busy, it runs again on the next run()
+  void retry();
+
+  // True until the wait after the last step elapsed
+  bool busy() const;
+
+  // Runs the next step if its wait is over
+  void run(unsigned long now);
+
+private:
+  const Step* _steps;
+  uint8_t _count;
+  uint8_t _next;
+  unsigned long _waitStart;
+  unsigned long _wait;
+};
+
+#endif
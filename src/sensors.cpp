@@ -0,0 +1,73 @@
+#include "sensors.h"
+
+void listSensorPackets(SensorSet needed, uint8_t groups, uint8_t* packets){
+  for(uint8_t group = 0; group < SENSOR_GROUPS; group++){
+    if(groups & (1 << group)){
+      *packets++ = group;
+    }
+  }
+  for(uint8_t id = FIRST_SENSOR_PACKET; id <= LAST_SENSOR_PACKET; id++){
+    if((needed & sensorSet(id)) && !sensorGroupsCover(groups, id)){
+      *packets++ = id;
+    }
+  }
+}
+
+int32_t decodeSensor(uint8_t id, const uint8_t* data){
+  const SensorSpec& spec = sensorSpec(id);
+  if(spec.length == 1){
+    return spec.isSigned ? (int32_t) (int8_t) data[0] : data[0];
+  }
+  uint16_t value = (data[0] << 8) | data[1];
+  return spec.isSigned ? (int32_t) (int16_t) value : value;
+}
+
+SensorReadings::SensorReadings(){
+  clear();
+}
+
+void SensorReadings::clear(){
+  _received = 0;
+  _rejected = 0;
+}
+
+void SensorReadings::decodePacket(uint8_t id, const uint8_t* data){
+  if(isSensorGroup(id)){
+    for(uint8_t member = SENSOR_GROUP_FIRST[id]; member <= SENSOR_GROUP_LAST[id]; member++){
+      decodePacket(member, data);
+      data += sensorLength(member);
+    }
+    return;
+  }
+  const SensorSpec& spec = sensorSpec(id);
+  int32_t value = decodeSensor(id, data);
+  _values[id - FIRST_SENSOR_PACKET] = value;
+  _received |= sensorSet(id);
+  if(value < spec.min || value > spec.max){
+    _rejected |= sensorSet(id);
+  }
+  else {
+    _rejected &= ~sensorSet(id);
+  }
+}
+
+bool SensorReadings::decodeReply(const uint8_t* ids, uint8_t count, const uint8_t* data, uint8_t length){
+  uint8_t i = 0;
+  for(uint8_t n = 0; n < count; n++){
+    uint8_t id = ids[n];
+    if(id > LAST_SENSOR_PACKET || i + sensorLength(id) > length){
+      return false;
+    }
+    decodePacket(id, data + i);
+    i += sensorLength(id);
+  }
+  return true;
+}
+
+bool SensorReadings::has(uint8_t id) const {
+  return (_received & ~_rejected & sensorSet(id)) != 0;
+}
+
+int32_t SensorReadings::value(uint8_t id) const {
+  return _values[id - FIRST_SENSOR_PACKET];
+}
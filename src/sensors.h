@@ -0,0 +1,207 @@
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include <Arduino.h>
+#include <Roomba.h>
+
+/* Schema of the OI sensor packets and a generic decoder. Every packet id
+ * from 7 to 42 has an entry, groups 0 to 6 are ranges of them. Reading a
+ * new sensor is adding it to the set of a feature, see SensorPlan.
+ *
+ * A set of packets is planned at compile time : the groups whose extra
+ * bytes cost less than asking for their members one by one, then the
+ * remaining packets. Each packet costs its id (in the query list or in
+ * the stream frame) and its data. */
+
+const uint8_t FIRST_SENSOR_PACKET = Roomba::SensorBumpsAndWheelDrops;
+const uint8_t LAST_SENSOR_PACKET = Roomba::SensorLeftVelocity;
+const uint8_t SENSOR_PACKETS = LAST_SENSOR_PACKET - FIRST_SENSOR_PACKET + 1;
+const uint8_t SENSOR_GROUPS = 7;
+// One bit per group subset tried by the planner
+const uint8_t SENSOR_GROUP_SUBSETS = 1 << SENSOR_GROUPS;
+
+struct SensorSpec {
+  uint8_t length; // bytes, big-endian
+  bool isSigned;
+  uint8_t decimals; // of the value in its unit, 3 for mV shown in V
+  // Values outside are dropped, some are tighter than the OI allows
+  // because the roomba sometimes sends garbage
+  int32_t min;
+  int32_t max;
+};
+
+// Indexed by packet id - FIRST_SENSOR_PACKET
+constexpr SensorSpec SENSOR_SPECS[SENSOR_PACKETS] = {
+  { 1, false, 0, 0, 31 },         // 7 bumps and wheel drops
+  { 1, false, 0, 0, 1 },          // 8 wall
+  { 1, false, 0, 0, 1 },          // 9 cliff left
+  { 1, false, 0, 0, 1 },          // 10 cliff front left
+  { 1, false, 0, 0, 1 },          // 11 cliff front right
+  { 1, false, 0, 0, 1 },          // 12 cliff right
+  { 1, false, 0, 0, 1 },          // 13 virtual wall
+  { 1, false, 0, 0, 31 },         // 14 overcurrents
+  { 1, false, 0, 0, 255 },        // 15 unused
+  { 1, false, 0, 0, 255 },        // 16 unused
+  { 1, false, 0, 0, 255 },        // 17 IR byte
+  { 1, false, 0, 0, 255 },        // 18 buttons
+  { 2, true, 0, -32768, 32767 },  // 19 distance, mm since the last read
+  { 2, true, 0, -32768, 32767 },  // 20 angle, degrees since the last read
+  { 1, false, 0, 0, 5 },          // 21 charging state
+  { 2, false, 3, 0, 25000 },      // 22 voltage, mV, about 17 V fully charged
+  { 2, true, 0, -6000, 6000 },    // 23 current, mA, about 2 A in regular use
+  { 1, true, 0, -128, 127 },      // 24 battery temperature, °C
+  { 2, false, 0, 0, 5000 },       // 25 charge, mAh, the biggest battery is about 4000 mAh
+  { 2, false, 0, 0, 5000 },       // 26 capacity, mAh
+  { 2, false, 0, 0, 4095 },       // 27 wall signal
+  { 2, false, 0, 0, 4095 },       // 28 cliff left signal
+  { 2, false, 0, 0, 4095 },       // 29 cliff front left signal
+  { 2, false, 0, 0, 4095 },       // 30 cliff front right signal
+  { 2, false, 0, 0, 4095 },       // 31 cliff right signal
+  { 1, false, 0, 0, 31 },         // 32 user digital inputs
+  { 2, false, 0, 0, 1023 },       // 33 user analog input
+  { 1, false, 0, 0, 3 },          // 34 charging sources available
+  { 1, false, 0, 0, 3 },          // 35 OI mode
+  { 1, false, 0, 0, 15 },         // 36 song number
+  { 1, false, 0, 0, 1 },          // 37 song playing
+  { 1, false, 0, 0, 43 },         // 38 number of stream packets
+  { 2, true, 0, -500, 500 },      // 39 requested velocity, mm/s
+  { 2, true, 0, -32768, 32767 },  // 40 requested radius, mm
+  { 2, true, 0, -500, 500 },      // 41 requested right velocity, mm/s
+  { 2, true, 0, -500, 500 },      // 42 requested left velocity, mm/s
+};
+
+// Packets 0 to 6, first and last member
+constexpr uint8_t SENSOR_GROUP_FIRST[SENSOR_GROUPS] = { 7, 7, 17, 21, 27, 35, 7 };
+constexpr uint8_t SENSOR_GROUP_LAST[SENSOR_GROUPS] = { 26, 16, 20, 26, 34, 42, 42 };
+
+// One bit per packet id
+typedef uint64_t SensorSet;
+
+constexpr SensorSet sensorSet(){
+  return 0;
+}
+
+template<typename... Ids>
+constexpr SensorSet sensorSet(uint8_t id, Ids... ids){
+  return ((SensorSet) 1 << id) | sensorSet(ids...);
+}
+
+constexpr const SensorSpec& sensorSpec(uint8_t id){
+  return SENSOR_SPECS[id - FIRST_SENSOR_PACKET];
+}
+
+constexpr bool isSensorGroup(uint8_t id){
+  return id < SENSOR_GROUPS;
+}
+
+// Data bytes of the packets first to last
+constexpr uint8_t sensorRangeLength(uint8_t first, uint8_t last){
+  return first > last ? 0 : sensorSpec(first).length + sensorRangeLength(first + 1, last);
+}
+
+// Data bytes of a packet or a group
+constexpr uint8_t sensorLength(uint8_t id){
+  return isSensorGroup(id) ? sensorRangeLength(SENSOR_GROUP_FIRST[id], SENSOR_GROUP_LAST[id])
+                           : sensorSpec(id).length;
+}
+
+static_assert(sensorLength(Roomba::Sensors7to26) == 26 && sensorLength(Roomba::Sensors7to16) == 10
+              && sensorLength(Roomba::Sensors17to20) == 6 && sensorLength(Roomba::Sensors21to26) == 10
+              && sensorLength(Roomba::Sensors27to34) == 14 && sensorLength(Roomba::Sensors35to42) == 12
+              && sensorLength(Roomba::Sensors7to42) == 52, "Packet lengths don't add up to the OI groups");
+
+// True when one of the groups of the subset contains the packet
+constexpr bool sensorGroupsCover(uint8_t groups, uint8_t id, uint8_t group = 0){
+  return group < SENSOR_GROUPS
+    && (((groups & (1 << group)) && id >= SENSOR_GROUP_FIRST[group] && id <= SENSOR_GROUP_LAST[group])
+        || sensorGroupsCover(groups, id, group + 1));
+}
+
+// Id and data bytes of the groups of the subset
+constexpr uint16_t sensorGroupsCost(uint8_t groups, uint8_t group = 0){
+  return group >= SENSOR_GROUPS ? 0
+    : ((groups & (1 << group)) ? 1 + sensorLength(group) : 0) + sensorGroupsCost(groups, group + 1);
+}
+
+// Id and data bytes of the needed packets the groups don't cover
+constexpr uint16_t sensorSinglesCost(SensorSet needed, uint8_t groups, uint8_t id = FIRST_SENSOR_PACKET){
+  return id > LAST_SENSOR_PACKET ? 0
+    : ((needed & sensorSet(id)) && !sensorGroupsCover(groups, id) ? 1 + sensorLength(id) : 0)
+      + sensorSinglesCost(needed, groups, id + 1);
+}
+
+constexpr uint16_t sensorPlanCost(SensorSet needed, uint8_t groups){
+  return sensorGroupsCost(groups) + sensorSinglesCost(needed, groups);
+}
+
+// Cheapest subset of groups, a tie keeps the first one tried (no group first)
+constexpr uint8_t sensorPlanGroups(SensorSet needed, uint8_t groups = 1, uint8_t best = 0){
+  return groups >= SENSOR_GROUP_SUBSETS ? best
+    : sensorPlanGroups(needed, groups + 1,
+                       sensorPlanCost(needed, groups) < sensorPlanCost(needed, best) ? groups : best);
+}
+
+constexpr uint8_t sensorGroupCount(uint8_t groups){
+  return groups == 0 ? 0 : (groups & 1) + sensorGroupCount(groups >> 1);
+}
+
+constexpr uint8_t sensorSinglesCount(SensorSet needed, uint8_t groups, uint8_t id = FIRST_SENSOR_PACKET){
+  return id > LAST_SENSOR_PACKET ? 0
+    : ((needed & sensorSet(id)) && !sensorGroupsCover(groups, id) ? 1 : 0)
+      + sensorSinglesCount(needed, groups, id + 1);
+}
+
+// Writes the ids of the groups then of the needed packets they don't cover
+void listSensorPackets(SensorSet needed, uint8_t groups, uint8_t* packets);
+
+// Packets to ask for to get the Needed sensors, planned at compile time
+template<SensorSet Needed>
+class SensorPlan {
+public:
+  static constexpr uint8_t GROUPS = sensorPlanGroups(Needed);
+  static constexpr uint8_t COUNT = sensorGroupCount(GROUPS) + sensorSinglesCount(Needed, GROUPS);
+  // Ids and data, the payload of a stream frame
+  static constexpr uint8_t FRAME_SIZE = sensorPlanCost(Needed, GROUPS);
+  // Data only, the reply to a query list
+  static constexpr uint8_t REPLY_SIZE = FRAME_SIZE - COUNT;
+
+  SensorPlan(){
+    listSensorPackets(Needed, GROUPS, packets);
+  }
+
+  uint8_t packets[COUNT];
+};
+
+int32_t decodeSensor(uint8_t id, const uint8_t* data);
+
+// Latest value of each packet of a frame or query reply. Groups are split
+// into their packets
+class SensorReadings {
+public:
+  SensorReadings();
+
+  // Forgets the previous frame
+  void clear();
+
+  // Data of a packet or a group, as in a stream frame
+  void decodePacket(uint8_t id, const uint8_t* data);
+
+  // Data of the packets in the order of ids, as replied to a query list
+  bool decodeReply(const uint8_t* ids, uint8_t count, const uint8_t* data, uint8_t length);
+
+  // Received and in range
+  bool has(uint8_t id) const;
+  // All of them received, in range or not
+  bool received(SensorSet sensors) const { return (_received & sensors) == sensors; }
+  int32_t value(uint8_t id) const;
+
+  // Received but out of range, value() is what was received
+  SensorSet rejected() const { return _rejected; }
+
+private:
+  int32_t _values[SENSOR_PACKETS];
+  SensorSet _received;
+  SensorSet _rejected;
+};
+
+#endif
@@ -0,0 +1,163 @@
+// main.cpp
+//
+// Entry point of the native environment : runs the firmware's setup() and
+// loop() on the simulated clock, with a RoombaSim on the Serial port, prints
+// what the firmware publishes and a timing summary at the end.
+//
+// Usage : program [simulated seconds] [time:command]...
+//   program 120 10:start 60:stop
+// sends "start" on roomba/commands at 10 s and "stop" at 60 s.
+// time:topic=payload publishes on another topic.
+// time:wifi=off and time:broker=off cut the wifi or the broker, =on brings
+// them back. time:scripts=off makes the robot a 600 without script commands,
+// time:robot=reboot reboots it.
+//
+// Left out of the esp01_1m build by its src_filter, and of the unit tests
+// which have their own main().
+
+#ifndef PIO_UNIT_TESTING
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <ESP8266WiFi.h>
+#include "RoombaSim.h"
+
+void setup();
+void loop();
+
+// Defined by the firmware
+extern PubSubClient client;
+extern WiFiClient wifiClient;
+
+// Simulated time between two calls of loop(), the rest of the ESP8266
+// system (wifi, lwIP) runs in between
+const uint64_t LOOP_PERIOD_US = 1000;
+
+struct ScheduledMessage {
+  uint64_t at;
+  std::string topic;
+  std::string payload;
+};
+
+static bool parseMessage(const char* argument, ScheduledMessage& message) {
+  const char* colon = strchr(argument, ':');
+  if(!colon) {
+    return false;
+  }
+  message.at = (uint64_t) (atof(argument) * 1000000);
+  std::string rest(colon + 1);
+  size_t equal = rest.find('=');
+  if(equal == std::string::npos) {
+    message.topic = "roomba/commands";
+    message.payload = rest;
+  }
+  else {
+    message.topic = rest.substr(0, equal);
+    message.payload = rest.substr(equal + 1);
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  uint64_t runTime = (argc > 1 ? strtoull(argv[1], NULL, 10) : 60) * 1000000ULL;
+  std::vector<ScheduledMessage> messages;
+  for(int i = 2; i < argc; i++) {
+    ScheduledMessage message;
+    if(!parseMessage(argv[i], message)) {
+      fprintf(stderr, "Expected time:command, got %s\n", argv[i]);
+      return 1;
+    }
+    messages.push_back(message);
+  }
+
+  RoombaSim roomba(Serial);
+  client.setVerbose(true);
+
+  unsigned long loops = 0;
+  uint64_t busyTime = 0;
+  uint64_t maxLoopTime = 0;
+  // Age of the freshest sensor data the firmware had received at each
+  // telemetry publication
+  unsigned long publications = 0;
+  uint64_t ageTotal = 0;
+  uint64_t maxAge = 0;
+  unsigned long mqttMessages = 0;
+
+  setup();
+  while(mock::now() < runTime && !ESP.restartRequested()) {
+    for(size_t i = 0; i < messages.size(); i++) {
+      if(messages[i].at <= mock::now() && !messages[i].topic.empty()) {
+        bool on = messages[i].payload == "on";
+        if(messages[i].topic == "wifi") {
+          WiFi.setConnected(on);
+          printf("%10.3f wifi %s\n", millis() / 1000.0, on ? "up" : "down");
+        }
+        else if(messages[i].topic == "broker") {
+          client.setBrokerReachable(on);
+          printf("%10.3f broker %s\n", millis() / 1000.0, on ? "up" : "down");
+        }
+        else if(messages[i].topic == "scripts") {
+          roomba.setScripts(on);
+        }
+        else if(messages[i].topic == "robot" && messages[i].payload == "reboot") {
+          roomba.update(mock::now());
+          roomba.reboot(mock::now());
+          printf("%10.3f robot rebooted\n", millis() / 1000.0);
+        }
+        else {
+          client.receive(messages[i].topic.c_str(), messages[i].payload.c_str());
+        }
+        messages[i].topic.clear();
+      }
+    }
+
+    uint64_t start = mock::now();
+    loop();
+    uint64_t loopTime = mock::now() - start;
+    loops++;
+    busyTime += loopTime;
+    if(loopTime > maxLoopTime) {
+      maxLoopTime = loopTime;
+    }
+
+    std::vector<PubSubClient::Message>& published = client.published();
+    mqttMessages += published.size();
+    for(size_t i = 0; i < published.size(); i++) {
+      if(published[i].topic.compare(0, 15, "roomba/battery/") != 0) {
+        continue;
+      }
+      uint64_t sampled = roomba.freshestDelivered(mock::now());
+      if(sampled > 0) {
+        uint64_t age = mock::now() - sampled;
+        publications++;
+        ageTotal += age;
+        if(age > maxAge) {
+          maxAge = age;
+        }
+      }
+    }
+    published.clear();
+
+    mock::advanceMicros(LOOP_PERIOD_US);
+  }
+  if(ESP.restartRequested()) {
+    printf("%10.3f restart requested\n", millis() / 1000.0);
+  }
+
+  const RoombaSim::Stats& stats = roomba.stats();
+  printf("\n");
+  printf("loop()           %lu calls, mean %.3f ms, max %.3f ms\n",
+         loops, loops ? busyTime / 1000.0 / loops : 0.0, maxLoopTime / 1000.0);
+  printf("sensor data age  %lu publications, mean %.1f ms, max %.1f ms\n",
+         publications, publications ? ageTotal / 1000.0 / publications : 0.0, maxAge / 1000.0);
+  printf("robot            mode %d, %lu commands (%lu ignored, %lu unknown opcodes), %lu mode changes\n",
+         roomba.mode(), stats.commands, stats.ignoredCommands, stats.unknownOpcodes, stats.modeChanges);
+  printf("serial           %lu bytes received, %lu sent, %lu queries, %lu stream frames (%lu skipped), "
+         "%lu overruns\n",
+         stats.bytesReceived, stats.bytesSent, stats.queries, stats.streamFrames, stats.skippedFrames,
+         Serial.overruns());
+  printf("mqtt             %lu messages published in %lu TCP writes\n", mqttMessages, wifiClient.writes());
+  return 0;
+}
+
+#endif
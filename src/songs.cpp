@@ -0,0 +1,91 @@
+#include "songs.h"
+
+// Time in ms
+const unsigned long SONG_MODE_WAIT = 100;
+// The robot reads its commands every 15 ms
+const unsigned long SONG_LOAD_WAIT = 20;
+const unsigned long SONG_END_MARGIN = 20;
+
+SongPlayer::SongPlayer(Roomba& roomba)
+  : _roomba(roomba), _parts(NULL), _count(0), _next(0),
+    _state(SongIdle), _waitStart(0), _wait(0) {
+  invalidate();
+}
+
+void SongPlayer::play(const Song* const* parts, uint8_t count){
+  _parts = parts;
+  _count = count;
+  _next = 0;
+  _state = SongMode;
+  _wait = 0;
+}
+
+void SongPlayer::stop(){
+  _parts = NULL;
+  _count = 0;
+  _state = SongIdle;
+}
+
+bool SongPlayer::busy() const {
+  return _state != SongIdle;
+}
+
+void SongPlayer::invalidate(){
+  for(uint8_t i = 0; i < SONG_SLOTS; i++){
+    _loaded[i] = NULL;
+  }
+}
+
+void SongPlayer::wait(unsigned long now, unsigned long ms){
+  _waitStart = now;
+  _wait = ms;
+}
+
+void SongPlayer::run(unsigned long now){
+  if(_state == SongIdle || now - _waitStart < _wait){
+    return;
+  }
+  switch(_state){
+    case SongMode:
+      // Nothing to wait for when it is already in full mode
+      _state = SongLoad;
+      wait(now, _roomba.ensureMode(Roomba::ModeFull) ? SONG_MODE_WAIT : 0);
+      break;
+
+    case SongLoad: {
+      if(_next >= _count){
+        _state = SongEnd;
+        wait(now, 0);
+        break;
+      }
+      const Song* part = _parts[_next];
+      _state = SongPlay;
+      if(_loaded[part->slot] == part){
+        // Already in the robot, play right away
+        wait(now, 0);
+        break;
+      }
+      _roomba.song_P(part->slot, part->notes, part->length);
+      _loaded[part->slot] = part;
+      wait(now, SONG_LOAD_WAIT);
+      break;
+    }
+
+    case SongPlay: {
+      const Song* part = _parts[_next++];
+      _roomba.playSong(part->slot);
+      _state = SongLoad;
+      wait(now, part->durationMs + SONG_END_MARGIN);
+      break;
+    }
+
+    case SongEnd:
+      // Back to passive, the robot can charge again
+      _roomba.ensureMode(Roomba::ModePassive);
+      stop();
+      break;
+
+    case SongIdle:
+      break;
+  }
+}
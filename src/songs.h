@@ -0,0 +1,88 @@
+#ifndef SONGS_H
+#define SONGS_H
+
+#include <Arduino.h>
+#include <Roomba.h>
+
+/* Non blocking song playback. A tune is a list of parts, each one fitting
+ * in an OI song slot, played one after the other from loop(). The player
+ * remembers what was uploaded in each slot so playing a tune again only
+ * sends the play commands.
+ *
+ * Parts are built at compile time with makeSong() from notes in PROGMEM :
+ *   constexpr uint8_t chimeNotes[] PROGMEM = { 72, 16, 76, 16, 79, 32 };
+ *   constexpr Song chime = makeSong<0>(chimeNotes);
+ * A wrong slot or note count fails the build. */
+
+// The OI of the 500 and 600 series has slots 0 to 4, the Create one 0 to
+// 15. Songs in the slots above are silently dropped by the target robots
+const uint8_t SONG_SLOTS = 5;
+const uint8_t MAX_SONG_NOTES = 16;
+
+// Notes are (note, duration in 1/64 s) pairs as sent to Roomba::song()
+struct Song {
+  uint8_t slot;
+  const uint8_t* notes; // PROGMEM
+  uint8_t length; // bytes, twice the number of notes
+  unsigned long durationMs;
+};
+
+// Sum of the note durations, in 1/64 s
+constexpr unsigned long songTicks(const uint8_t* notes, uint8_t length){
+  return length < 2 ? 0 : notes[1] + songTicks(notes + 2, length - 2);
+}
+
+// Rounded up so the next part never starts on the last note
+constexpr unsigned long songTicksToMs(unsigned long ticks){
+  return (ticks * 1000 + 63) / 64;
+}
+
+template<uint8_t Slot, size_t N>
+constexpr Song makeSong(const uint8_t (&notes)[N]){
+  static_assert(Slot < SONG_SLOTS, "OI song slots of the 500 and 600 series are 0 to 4");
+  static_assert(N % 2 == 0, "Notes are (note, duration) pairs");
+  static_assert(N >= 2 && N / 2 <= MAX_SONG_NOTES, "An OI song holds 1 to 16 notes");
+  return Song{ Slot, notes, N, songTicksToMs(songTicks(notes, N)) };
+}
+
+class SongPlayer {
+public:
+  explicit SongPlayer(Roomba& roomba);
+
+  // Replaces whatever was playing, starts on the next run()
+  void play(const Song* const* parts, uint8_t count);
+
+  // Stops scheduling the parts, the note in progress still ends
+  void stop();
+
+  // True until the last part finished and the robot is back to passive
+  bool busy() const;
+
+  // The robot lost its songs (reboot, battery swap), upload them again
+  void invalidate();
+
+  // Sends the next command if its wait is over
+  void run(unsigned long now);
+
+private:
+  enum State {
+    SongIdle,
+    SongMode,
+    SongLoad,
+    SongPlay,
+    SongEnd
+  };
+
+  void wait(unsigned long now, unsigned long ms);
+
+  Roomba& _roomba;
+  const Song* const* _parts;
+  uint8_t _count;
+  uint8_t _next;
+  State _state;
+  unsigned long _waitStart;
+  unsigned long _wait;
+  const Song* _loaded[SONG_SLOTS];
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "stream_parser.h"
+
+StreamParser::StreamParser(uint8_t* buffer, uint8_t size)
+  : _buffer(buffer), _size(size), _expected(0) {
+  reset();
+  resetStats();
+}
+
+void StreamParser::expect(uint8_t payloadSize){
+  _expected = payloadSize;
+}
+
+void StreamParser::reset(){
+  _length = 0;
+  _frameLength = 0;
+  _packetCount = 0;
+}
+
+void StreamParser::resetStats(){
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+void StreamParser::overrun(){
+  _stats.overruns++;
+  // The next header starts the next frame
+  _stats.discarded += _length - _frameLength;
+  reset();
+}
+
+void StreamParser::skipTo(uint8_t from){
+  uint8_t next = from;
+  while(next < _length && _buffer[next] != STREAM_HEADER){
+    next++;
+  }
+  _stats.discarded += next;
+  _length -= next;
+  memmove(_buffer, _buffer + next, _length);
+}
+
+bool StreamParser::checksumOk(uint8_t frameLength) const {
+  uint8_t sum = 0;
+  for(uint8_t i = 0; i < frameLength; i++){
+    sum += _buffer[i];
+  }
+  return sum == 0;
+}
+
+bool StreamParser::indexPackets(uint8_t payloadSize){
+  uint8_t end = 2 + payloadSize;
+  uint8_t i = 2;
+  _packetCount = 0;
+  while(i < end){
+    uint8_t id = _buffer[i];
+    if(id > LAST_SENSOR_PACKET || _packetCount == MAX_STREAM_PACKETS || i + 1 + sensorLength(id) > end){
+      _packetCount = 0;
+      return false;
+    }
+    _offsets[_packetCount++] = i;
+    i += 1 + sensorLength(id);
+  }
+  return true;
+}
+
+// Drops what can't be the start of a frame, true when one is complete
+bool StreamParser::check(){
+  while(_length > 0){
+    if(_buffer[0] != STREAM_HEADER){
+      skipTo(1);
+      continue;
+    }
+    if(_length < 2){
+      return false;
+    }
+    uint8_t payloadSize = _buffer[1];
+    uint8_t frameLength = payloadSize + STREAM_FRAME_OVERHEAD;
+    if((_expected != 0 && payloadSize != _expected) || payloadSize > _size - STREAM_FRAME_OVERHEAD){
+      // The 19 was a data byte
+      _stats.malformed++;
+      _stats.resyncs++;
+      skipTo(1);
+      continue;
+    }
+    if(_length < frameLength){
+      return false;
+    }
+    if(!checksumOk(frameLength)){
+      _stats.checksumErrors++;
+      _stats.resyncs++;
+      skipTo(1);
+      continue;
+    }
+    if(!indexPackets(payloadSize)){
+      _stats.malformed++;
+      _stats.resyncs++;
+      skipTo(1);
+      continue;
+    }
+    _stats.frames++;
+    _frameLength = frameLength;
+    return true;
+  }
+  return false;
+}
+
+bool StreamParser::feed(uint8_t c){
+  if(_frameLength > 0){
+    // Bytes after the returned frame were kept by a resync
+    _length -= _frameLength;
+    memmove(_buffer, _buffer + _frameLength, _length);
+    _frameLength = 0;
+    _packetCount = 0;
+  }
+  if(_length == _size){
+    // Can't be a frame that fits, keep looking from the next header
+    _stats.malformed++;
+    _stats.resyncs++;
+    skipTo(1);
+  }
+  _buffer[_length++] = c;
+  return check();
+}
+
+const uint8_t* StreamParser::find(uint8_t id) const {
+  for(uint8_t i = 0; i < _packetCount; i++){
+    if(packetId(i) == id){
+      return packetData(i);
+    }
+  }
+  return NULL;
+}
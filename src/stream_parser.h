@@ -0,0 +1,100 @@
+#ifndef STREAM_PARSER_H
+#define STREAM_PARSER_H
+
+#include <Arduino.h>
+#include "sensors.h"
+
+/* Parser of the frames pushed by the roomba in stream mode :
+ *   19, payload size, payload, checksum
+ * where the payload is each packet id followed by its data, and all the
+ * bytes of the frame add up to 0.
+ *
+ * A frame is only accepted when its checksum is right and its packets
+ * exactly fill the payload. After a bad frame, the bytes already received
+ * are searched for the next 19 instead of waiting for a new one, so a
+ * single corrupted byte costs one frame. The packets of the last frame
+ * are indexed and read in place in the buffer given by the caller. */
+
+const uint8_t STREAM_HEADER = 19;
+// Header, payload size and checksum
+const uint8_t STREAM_FRAME_OVERHEAD = 3;
+const uint8_t MAX_STREAM_PACKETS = 16;
+
+struct StreamStats {
+  uint32_t frames;
+  uint32_t checksumErrors;
+  // Unexpected payload size, unknown packet id or packets not filling it
+  uint32_t malformed;
+  // Searches for a header inside a rejected frame
+  uint32_t resyncs;
+  // Bytes that were not part of an accepted frame
+  uint32_t discarded;
+  // Reported by the UART, bytes were lost before reaching the parser
+  uint32_t overruns;
+};
+
+class StreamParser {
+public:
+  // buffer holds the largest frame, payload and overhead
+  StreamParser(uint8_t* buffer, uint8_t size);
+
+  // Payload size of the configured stream, frames of another size are
+  // rejected from their second byte. 0 accepts any size that fits
+  void expect(uint8_t payloadSize);
+
+  // Forgets the frame in progress, e.g. after the stream was restarted
+  void reset();
+
+  // Consumes a received byte, true when it completed a valid frame.
+  // The frame stays readable until the next call
+  bool feed(uint8_t c);
+
+  // Bytes were lost, the frame in progress can't be trusted
+  void overrun();
+
+  uint8_t packetCount() const { return _packetCount; }
+  uint8_t packetId(uint8_t index) const { return _buffer[_offsets[index]]; }
+  const uint8_t* packetData(uint8_t index) const { return _buffer + _offsets[index] + 1; }
+  // NULL when the last frame doesn't have the packet
+  const uint8_t* find(uint8_t id) const;
+
+  const StreamStats& stats() const { return _stats; }
+  void resetStats();
+
+private:
+  // Drops the bytes before the next header found from index from
+  void skipTo(uint8_t from);
+  bool checksumOk(uint8_t frameLength) const;
+  bool indexPackets(uint8_t payloadSize);
+  bool check();
+
+  uint8_t* _buffer;
+  uint8_t _size;
+  uint8_t _expected;
+  uint8_t _length;
+  // Length of the frame returned by feed(), dropped on the next one
+  uint8_t _frameLength;
+  uint8_t _offsets[MAX_STREAM_PACKETS];
+  uint8_t _packetCount;
+  StreamStats _stats;
+};
+
+// The 2.4 core added hasOverrun() to HardwareSerial, with the pinned 2.3
+// core overruns go unseen
+template<typename T>
+auto serialOverrun(T& serial, int) -> decltype(serial.hasOverrun()){
+  return serial.hasOverrun();
+}
+
+template<typename T>
+bool serialOverrun(T&, long){
+  return false;
+}
+
+// True once after the UART dropped received bytes
+template<typename T>
+bool serialOverrun(T& serial){
+  return serialOverrun(serial, 0);
+}
+
+#endif
@@ -0,0 +1,142 @@
+#include "telemetry.h"
+
+MetricFilter::MetricFilter(int32_t deadband, unsigned long heartbeatMs)
+  : _deadband(deadband), _heartbeat(heartbeatMs), _lastValue(0), _lastPublish(0), _valid(false) {
+}
+
+bool MetricFilter::shouldPublish(int32_t value, unsigned long now) const {
+  if(!_valid || now - _lastPublish >= _heartbeat){
+    return true;
+  }
+  int32_t change = value - _lastValue;
+  if(change < 0){
+    change = -change;
+  }
+  return change > _deadband;
+}
+
+void MetricFilter::published(int32_t value, unsigned long now){
+  _lastValue = value;
+  _lastPublish = now;
+  _valid = true;
+}
+
+void MetricFilter::invalidate(){
+  _valid = false;
+}
+
+RangeStats::RangeStats(){
+  reset();
+}
+
+void RangeStats::add(int32_t value){
+  if(_count == 0 || value < _min){
+    _min = value;
+  }
+  if(_count == 0 || value > _max){
+    _max = value;
+  }
+  _sum += value;
+  _count++;
+}
+
+void RangeStats::reset(){
+  _min = 0;
+  _max = 0;
+  _sum = 0;
+  _count = 0;
+}
+
+int32_t RangeStats::mean() const {
+  if(_count == 0){
+    return 0;
+  }
+  // Rounds half away from zero for negative currents too
+  int64_t half = _sum < 0 ? -(int64_t)(_count / 2) : _count / 2;
+  return (_sum + half) / (int64_t) _count;
+}
+
+static void writeLittleEndian(uint8_t* buffer, uint16_t value){
+  buffer[0] = value & 0xff;
+  buffer[1] = value >> 8;
+}
+
+static uint16_t readLittleEndian(const uint8_t* buffer){
+  return buffer[0] | (buffer[1] << 8);
+}
+
+size_t encodeTelemetryFrame(const TelemetrySample& sample, uint8_t* frame){
+  frame[0] = TELEMETRY_FRAME_VERSION;
+  frame[1] = sample.chargingState;
+  frame[2] = sample.percentage;
+  writeLittleEndian(frame + 3, sample.capacity);
+  writeLittleEndian(frame + 5, sample.charge);
+  writeLittleEndian(frame + 7, sample.voltage);
+  writeLittleEndian(frame + 9, sample.current);
+  writeLittleEndian(frame + 11, sample.minutesToEmpty);
+  writeLittleEndian(frame + 13, sample.minutesToFull);
+  return TELEMETRY_FRAME_SIZE;
+}
+
+bool decodeTelemetryFrame(const uint8_t* frame, size_t length, TelemetrySample& sample){
+  if(length < 1 || frame[0] < 1 || frame[0] > TELEMETRY_FRAME_VERSION
+     || length < (frame[0] == 1 ? TELEMETRY_FRAME_V1_SIZE : TELEMETRY_FRAME_SIZE)){
+    return false;
+  }
+  sample.chargingState = frame[1];
+  sample.percentage = frame[2];
+  sample.capacity = readLittleEndian(frame + 3);
+  sample.charge = readLittleEndian(frame + 5);
+  sample.voltage = readLittleEndian(frame + 7);
+  sample.current = readLittleEndian(frame + 9);
+  sample.minutesToEmpty = frame[0] == 1 ? -1 : (int16_t) readLittleEndian(frame + 11);
+  sample.minutesToFull = frame[0] == 1 ? -1 : (int16_t) readLittleEndian(frame + 13);
+  return true;
+}
+
+SampleRing::SampleRing(TimedSample* buffer, uint16_t capacity)
+  : _buffer(buffer), _capacity(capacity), _first(0), _size(0), _overwritten(0) {
+}
+
+void SampleRing::push(uint32_t time, const TelemetrySample& sample){
+  if(_capacity == 0){
+    return;
+  }
+  if(_size == _capacity){
+    drop(1);
+    _overwritten++;
+  }
+  TimedSample& slot = _buffer[(_first + _size) % _capacity];
+  slot.time = time;
+  slot.sample = sample;
+  _size++;
+}
+
+const TimedSample& SampleRing::at(uint16_t index) const {
+  return _buffer[(_first + index) % _capacity];
+}
+
+void SampleRing::drop(uint16_t count){
+  if(count > _size){
+    count = _size;
+  }
+  if(count == 0){
+    return;
+  }
+  _first = (_first + count) % _capacity;
+  _size -= count;
+}
+
+uint16_t SampleRing::size() const {
+  return _size;
+}
+
+uint32_t SampleRing::overwritten() const {
+  return _overwritten;
+}
+
+size_t encodeTelemetryRecord(const TimedSample& sample, uint8_t* record){
+  writeLittleEndian(record, sample.time);
+  writeLittleEndian(record + 2, sample.time >> 16);
+  return 4 + encodeTelemetryFrame(sample.sample, record + 4);
+}
@@ -0,0 +1,130 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+
+/* Decides when a telemetry value is worth publishing : when it moved by
+ * more than its deadband since the last publish, or when its heartbeat
+ * interval elapsed so subscribers still see it regularly. */
+class MetricFilter {
+public:
+  // deadband of 0 publishes any change
+  MetricFilter(int32_t deadband, unsigned long heartbeatMs);
+
+  bool shouldPublish(int32_t value, unsigned long now) const;
+
+  // Records what was sent, the next changes are measured from it
+  void published(int32_t value, unsigned long now);
+
+  // Forces the next shouldPublish() to return true, e.g. after a reconnect
+  void invalidate();
+
+private:
+  int32_t _deadband;
+  unsigned long _heartbeat;
+  int32_t _lastValue;
+  unsigned long _lastPublish;
+  bool _valid;
+};
+
+/* Compact telemetry frame, all the battery values in one MQTT message.
+ * Little-endian, layout of version 2 :
+ *   0     version (TELEMETRY_FRAME_VERSION)
+ *   1     charging state (OI packet 21)
+ *   2     battery percentage
+ *   3-4   capacity, mAh
+ *   5-6   charge, mAh
+ *   7-8   voltage, mV
+ *   9-10  current, mA, signed (negative when discharging)
+ *   11-12 minutes to empty, signed, -1 when not discharging
+ *   13-14 minutes to full, signed, -1 when not charging
+ * Version 1 stops after the current. Decoders must ignore frames with an
+ * unknown version, and bytes past the end of the layout they know so
+ * fields can be appended. */
+const uint8_t TELEMETRY_FRAME_VERSION = 2;
+const size_t TELEMETRY_FRAME_SIZE = 15;
+const size_t TELEMETRY_FRAME_V1_SIZE = 11;
+
+struct TelemetrySample {
+  uint8_t chargingState;
+  uint8_t percentage;
+  uint16_t capacity;
+  uint16_t charge;
+  uint16_t voltage;
+  int16_t current;
+  int16_t minutesToEmpty;
+  int16_t minutesToFull;
+};
+
+// frame must have room for TELEMETRY_FRAME_SIZE bytes, returns the size
+size_t encodeTelemetryFrame(const TelemetrySample& sample, uint8_t* frame);
+
+// Returns false if the frame is too short or of an unknown version. The
+// times of a version 1 frame are -1
+bool decodeTelemetryFrame(const uint8_t* frame, size_t length, TelemetrySample& sample);
+
+// Min, max and mean of a value sampled faster than it is published, e.g.
+// the current of every 15 ms stream frame. Integer accumulators only.
+class RangeStats {
+public:
+  RangeStats();
+
+  void add(int32_t value);
+  void reset();
+
+  uint32_t count() const { return _count; }
+  // min, max and mean are 0 when nothing was added
+  int32_t min() const { return _count ? _min : 0; }
+  int32_t max() const { return _count ? _max : 0; }
+  // Rounded to the nearest integer
+  int32_t mean() const;
+
+private:
+  int32_t _min;
+  int32_t _max;
+  int64_t _sum;
+  uint32_t _count;
+};
+
+struct TimedSample {
+  uint32_t time; // UTC seconds
+  TelemetrySample sample;
+};
+
+/* Samples kept while the broker is unreachable, in a buffer given by the
+ * caller so its size is fixed at compile time. When full the oldest one
+ * is overwritten, recent data matters more after a long outage. */
+class SampleRing {
+public:
+  SampleRing(TimedSample* buffer, uint16_t capacity);
+
+  void push(uint32_t time, const TelemetrySample& sample);
+
+  // index 0 is the oldest sample
+  const TimedSample& at(uint16_t index) const;
+
+  // Removes the count oldest samples, once they are sent
+  void drop(uint16_t count);
+
+  uint16_t size() const;
+
+  // Samples lost because the buffer was full
+  uint32_t overwritten() const;
+
+private:
+  TimedSample* _buffer;
+  uint16_t _capacity;
+  uint16_t _first;
+  uint16_t _size;
+  uint32_t _overwritten;
+};
+
+/* Backlog record, a timestamp followed by a telemetry frame :
+ *   0-3   time, UTC seconds, little-endian
+ *   4-18  telemetry frame */
+const size_t TELEMETRY_RECORD_SIZE = 4 + TELEMETRY_FRAME_SIZE;
+
+// record must have room for TELEMETRY_RECORD_SIZE bytes, returns the size
+size_t encodeTelemetryRecord(const TimedSample& sample, uint8_t* record);
+
+#endif
@@ -0,0 +1,95 @@
+#include <unity.h>
+#include "battery.h"
+
+// Interval of the stream frames
+const unsigned long FRAME_MS = 15;
+
+CoulombCounter* counter;
+
+void setUp(){
+  counter = new CoulombCounter();
+}
+
+void tearDown(){
+  delete counter;
+}
+
+// A steady current from now for duration ms, returns the time at the end
+unsigned long run(int16_t currentMa, unsigned long now, unsigned long duration){
+  for(unsigned long end = now + duration; now < end; now += FRAME_MS){
+    counter->update(currentMa, now);
+  }
+  counter->update(currentMa, now);
+  return now;
+}
+
+void test_not_anchored(){
+  TEST_ASSERT_FALSE(counter->anchored());
+  run(-1000, 0, 1000);
+  TEST_ASSERT_EQUAL_INT32(-1, counter->minutesToEmpty());
+  TEST_ASSERT_EQUAL_INT32(-1, counter->minutesToFull());
+}
+
+void test_anchor(){
+  counter->anchor(2000, 2700);
+  TEST_ASSERT_TRUE(counter->anchored());
+  TEST_ASSERT_EQUAL_UINT16(2000, counter->chargeMah());
+  TEST_ASSERT_EQUAL_UINT16(2700, counter->capacityMah());
+  TEST_ASSERT_EQUAL_UINT8(74, counter->percentage());
+}
+
+// 1 A for 36 s is 10 mAh
+void test_discharge(){
+  counter->anchor(2000, 2700);
+  run(-1000, 0, 36000);
+  TEST_ASSERT_EQUAL_UINT16(1990, counter->chargeMah());
+  TEST_ASSERT_EQUAL_INT16(-1000, counter->averageCurrentMa());
+  TEST_ASSERT_EQUAL_INT32(119, counter->minutesToEmpty());
+  TEST_ASSERT_EQUAL_INT32(-1, counter->minutesToFull());
+}
+
+void test_charge(){
+  counter->anchor(2000, 2700);
+  run(1500, 0, 36000);
+  TEST_ASSERT_EQUAL_UINT16(2015, counter->chargeMah());
+  TEST_ASSERT_EQUAL_INT32(27, counter->minutesToFull());
+  TEST_ASSERT_EQUAL_INT32(-1, counter->minutesToEmpty());
+}
+
+// The current of a gap in the readings is unknown
+void test_gap_not_integrated(){
+  counter->anchor(2000, 2700);
+  unsigned long now = run(-1000, 0, 36000);
+  counter->update(-1000, now + 60000);
+  TEST_ASSERT_EQUAL_UINT16(1990, counter->chargeMah());
+}
+
+void test_limits(){
+  counter->anchor(1, 2700);
+  run(-3600, 0, 2000);
+  TEST_ASSERT_EQUAL_UINT16(0, counter->chargeMah());
+  counter->anchor(2699, 2700);
+  run(3600, 10000, 2000);
+  TEST_ASSERT_EQUAL_UINT16(2700, counter->chargeMah());
+  TEST_ASSERT_EQUAL_UINT8(100, counter->percentage());
+}
+
+// Idle on or off the dock, no estimate
+void test_idle(){
+  counter->anchor(2000, 2700);
+  run(-20, 0, 10000);
+  TEST_ASSERT_EQUAL_INT32(-1, counter->minutesToEmpty());
+  TEST_ASSERT_EQUAL_INT32(-1, counter->minutesToFull());
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_not_anchored);
+  RUN_TEST(test_anchor);
+  RUN_TEST(test_discharge);
+  RUN_TEST(test_charge);
+  RUN_TEST(test_gap_not_integrated);
+  RUN_TEST(test_limits);
+  RUN_TEST(test_idle);
+  return UNITY_END();
+}
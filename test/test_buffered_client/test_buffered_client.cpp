@@ -0,0 +1,155 @@
+#include <unity.h>
+#include "buffered_client.h"
+
+// Socket keeping each write as a segment, takes at most limit bytes a write
+class Sink : public Client {
+public:
+  Sink() : limit(1024), open(true) {}
+
+  int connect(IPAddress ip, uint16_t port) { open = true; return 1; }
+  int connect(const char* host, uint16_t port) { open = true; return 1; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* data, size_t size){
+    size_t taken = size < limit ? size : limit;
+    segments.push_back(std::vector<uint8_t>(data, data + taken));
+    return taken;
+  }
+  int available() { return 0; }
+  int read() { return -1; }
+  int read(uint8_t* data, size_t size) { return 0; }
+  int peek() { return -1; }
+  void flush() {}
+  void stop() { open = false; }
+  uint8_t connected() { return open; }
+  operator bool() { return open; }
+
+  std::vector<std::vector<uint8_t> > segments;
+  size_t limit;
+  bool open;
+};
+
+const uint8_t DATA[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20 };
+
+Sink* sink;
+uint8_t buffer[8];
+BufferedClient* buffered;
+
+void setUp(){
+  sink = new Sink();
+  buffered = new BufferedClient(*sink, buffer, sizeof(buffer));
+}
+
+void tearDown(){
+  delete buffered;
+  delete sink;
+}
+
+// Connect, pings and acks go out right away
+void test_unheld_writes_sent(){
+  TEST_ASSERT_EQUAL(3, buffered->write(DATA, 3));
+  TEST_ASSERT_EQUAL(1, buffered->write(DATA[3]));
+  TEST_ASSERT_EQUAL(2, sink->segments.size());
+  TEST_ASSERT_EQUAL(3, sink->segments[0].size());
+  TEST_ASSERT_EQUAL_UINT32(2, buffered->segments());
+}
+
+void test_held_writes_gathered(){
+  buffered->hold();
+  buffered->write(DATA, 3);
+  buffered->write(DATA + 3, 4);
+  TEST_ASSERT_EQUAL(0, sink->segments.size());
+  buffered->release();
+  TEST_ASSERT_EQUAL(1, sink->segments.size());
+  TEST_ASSERT_EQUAL(7, sink->segments[0].size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(DATA, sink->segments[0].data(), 7);
+}
+
+void test_nested_holds(){
+  {
+    WriteBatch outer(*buffered);
+    {
+      WriteBatch inner(*buffered);
+      buffered->write(DATA, 2);
+    }
+    TEST_ASSERT_EQUAL(0, sink->segments.size());
+    buffered->write(DATA + 2, 2);
+  }
+  TEST_ASSERT_EQUAL(1, sink->segments.size());
+  TEST_ASSERT_EQUAL(4, sink->segments[0].size());
+  // An extra release does nothing
+  buffered->release();
+  TEST_ASSERT_EQUAL(1, sink->segments.size());
+}
+
+// A full buffer is sent before taking more
+void test_full_buffer_pushed(){
+  buffered->hold();
+  buffered->write(DATA, 5);
+  buffered->write(DATA + 5, 5);
+  TEST_ASSERT_EQUAL(1, sink->segments.size());
+  TEST_ASSERT_EQUAL(5, sink->segments[0].size());
+  buffered->release();
+  TEST_ASSERT_EQUAL(2, sink->segments.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(DATA + 5, sink->segments[1].data(), 5);
+}
+
+// Larger than the buffer, sent as is after what was waiting
+void test_large_write(){
+  buffered->hold();
+  buffered->write(DATA, 3);
+  TEST_ASSERT_EQUAL(20, buffered->write(DATA, 20));
+  TEST_ASSERT_EQUAL(2, sink->segments.size());
+  TEST_ASSERT_EQUAL(3, sink->segments[0].size());
+  TEST_ASSERT_EQUAL(20, sink->segments[1].size());
+  buffered->release();
+  TEST_ASSERT_EQUAL(2, sink->segments.size());
+}
+
+// Part of a packet may have gone out, the connection is dropped
+void test_short_write_drops_connection(){
+  sink->limit = 4;
+  buffered->hold();
+  buffered->write(DATA, 6);
+  TEST_ASSERT_FALSE(buffered->push());
+  TEST_ASSERT_EQUAL_UINT32(1, buffered->failedWrites());
+  TEST_ASSERT_FALSE(sink->open);
+  TEST_ASSERT_FALSE(buffered->connected());
+  buffered->release();
+  TEST_ASSERT_EQUAL(1, sink->segments.size());
+
+  sink->limit = 2;
+  TEST_ASSERT_EQUAL(0, buffered->write(DATA, 3));
+  TEST_ASSERT_EQUAL_UINT32(2, buffered->failedWrites());
+}
+
+// Packets of the previous connection are dropped
+void test_connect_discards_buffer(){
+  buffered->hold();
+  buffered->write(DATA, 5);
+  buffered->connect("broker", 1883);
+  buffered->release();
+  TEST_ASSERT_EQUAL(0, sink->segments.size());
+  TEST_ASSERT_EQUAL_UINT32(0, buffered->segments());
+}
+
+void test_stop_discards_buffer(){
+  buffered->hold();
+  buffered->write(DATA, 5);
+  buffered->stop();
+  TEST_ASSERT_FALSE(sink->open);
+  buffered->release();
+  TEST_ASSERT_EQUAL(0, sink->segments.size());
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_unheld_writes_sent);
+  RUN_TEST(test_held_writes_gathered);
+  RUN_TEST(test_nested_holds);
+  RUN_TEST(test_full_buffer_pushed);
+  RUN_TEST(test_large_write);
+  RUN_TEST(test_short_write_drops_connection);
+  RUN_TEST(test_connect_discards_buffer);
+  RUN_TEST(test_stop_discards_buffer);
+  return UNITY_END();
+}
@@ -0,0 +1,83 @@
+#include <unity.h>
+#include "commands.h"
+
+const char* called = NULL;
+CommandArgs received;
+
+void onStart(const CommandArgs& args){
+  called = "start";
+  received = args;
+}
+
+void onDrive(const CommandArgs& args){
+  called = "drive";
+  received = args;
+}
+
+const Command commands[] = {
+  COMMAND("start", 0, 0, onStart),
+  COMMAND("drive", 2, 2, onDrive),
+};
+
+void setUp(){
+  called = NULL;
+  memset(&received, 0, sizeof(received));
+}
+
+void tearDown(){
+}
+
+CommandResult dispatch(const char* payload){
+  return dispatchCommand(commands, (const uint8_t*) payload, strlen(payload));
+}
+
+void test_no_arguments(){
+  TEST_ASSERT_EQUAL(CommandOk, dispatch("start"));
+  TEST_ASSERT_EQUAL_STRING("start", called);
+  TEST_ASSERT_EQUAL_UINT8(0, received.count);
+}
+
+void test_arguments(){
+  TEST_ASSERT_EQUAL(CommandOk, dispatch("  drive\t200   -500\r\n"));
+  TEST_ASSERT_EQUAL_STRING("drive", called);
+  TEST_ASSERT_EQUAL_UINT8(2, received.count);
+  TEST_ASSERT_EQUAL_INT32(200, received.values[0]);
+  TEST_ASSERT_EQUAL_INT32(-500, received.values[1]);
+}
+
+void test_unknown(){
+  TEST_ASSERT_EQUAL(CommandUnknown, dispatch("stop"));
+  // Names match as a whole word
+  TEST_ASSERT_EQUAL(CommandUnknown, dispatch("star"));
+  TEST_ASSERT_EQUAL(CommandUnknown, dispatch("started"));
+  TEST_ASSERT_EQUAL(CommandUnknown, dispatch(""));
+  TEST_ASSERT_NULL(called);
+}
+
+void test_bad_arguments(){
+  TEST_ASSERT_EQUAL(CommandBadArgs, dispatch("drive 200"));
+  TEST_ASSERT_EQUAL(CommandBadArgs, dispatch("drive 200 -500 1"));
+  TEST_ASSERT_EQUAL(CommandBadArgs, dispatch("drive 200 fast"));
+  TEST_ASSERT_EQUAL(CommandBadArgs, dispatch("drive 200 -"));
+  TEST_ASSERT_EQUAL(CommandBadArgs, dispatch("drive 200 5x"));
+  TEST_ASSERT_EQUAL(CommandBadArgs, dispatch("drive 200 99999999999"));
+  TEST_ASSERT_EQUAL(CommandBadArgs, dispatch("start 1"));
+  TEST_ASSERT_NULL(called);
+}
+
+// MQTT payloads aren't terminated, nothing past length is read
+void test_payload_length(){
+  const char* payload = "drive 200 -500 1";
+  TEST_ASSERT_EQUAL(CommandOk, dispatchCommand(commands, (const uint8_t*) payload, 14));
+  TEST_ASSERT_EQUAL_INT32(-500, received.values[1]);
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_no_arguments);
+  RUN_TEST(test_arguments);
+  RUN_TEST(test_unknown);
+  RUN_TEST(test_bad_arguments);
+  RUN_TEST(test_payload_length);
+  return UNITY_END();
+}
@@ -0,0 +1,101 @@
+#include <unity.h>
+#include "coverage.h"
+
+// Keeps what is written
+class ByteSink : public Print {
+public:
+  ByteSink() : length(0) {}
+
+  size_t write(uint8_t c){
+    if(length == sizeof(data)){
+      return 0;
+    }
+    data[length++] = c;
+    return 1;
+  }
+
+  uint8_t data[256];
+  size_t length;
+};
+
+const uint16_t CELL_MM = 100;
+uint8_t cells[coverageBytes(10, 10)];
+
+void setUp(){
+}
+
+void tearDown(){
+}
+
+void test_empty_grid(){
+  CoverageGrid grid(cells, 4, 4, CELL_MM);
+  ByteSink out;
+  const uint8_t expected[] = { COVERAGE_MAP_VERSION, 4, 4, CELL_MM, 0, 15 };
+  TEST_ASSERT_EQUAL(sizeof(expected), grid.encode(&out));
+  TEST_ASSERT_EQUAL(sizeof(expected), out.length);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out.data, sizeof(expected));
+}
+
+// The origin is the center of the grid, rows go from the smallest y
+void test_runs(){
+  CoverageGrid grid(cells, 4, 4, CELL_MM);
+  grid.mark(0, 0, CellCovered);
+  grid.mark(-1, -1, CellDock);
+  grid.mark(150, 50, CellObstacle);
+  TEST_ASSERT_EQUAL(CellCovered, grid.cell(2, 2));
+  TEST_ASSERT_EQUAL(CellDock, grid.cell(1, 1));
+  TEST_ASSERT_EQUAL(CellObstacle, grid.cell(3, 2));
+  ByteSink out;
+  const uint8_t expected[] = { COVERAGE_MAP_VERSION, 4, 4, CELL_MM, 0,
+                               (CellUnknown << 6) | 4, (CellDock << 6) | 0, (CellUnknown << 6) | 3,
+                               (CellCovered << 6) | 0, (CellObstacle << 6) | 0, (CellUnknown << 6) | 3 };
+  TEST_ASSERT_EQUAL(sizeof(expected), grid.encode(&out));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out.data, sizeof(expected));
+  TEST_ASSERT_EQUAL(sizeof(expected), grid.encode(NULL));
+}
+
+void test_mark_priorities(){
+  CoverageGrid grid(cells, 4, 4, CELL_MM);
+  grid.mark(0, 0, CellObstacle);
+  grid.mark(0, 0, CellCovered);
+  TEST_ASSERT_EQUAL(CellObstacle, grid.cell(2, 2));
+  grid.mark(0, 0, CellDock);
+  grid.mark(0, 0, CellObstacle);
+  TEST_ASSERT_EQUAL(CellDock, grid.cell(2, 2));
+  // Outside of the grid, the map still only has the dock
+  grid.mark(200, 0, CellCovered);
+  grid.mark(0, -201, CellCovered);
+  TEST_ASSERT_EQUAL(COVERAGE_HEADER_SIZE + 3, grid.encode(NULL));
+  grid.clear();
+  TEST_ASSERT_EQUAL(CellUnknown, grid.cell(2, 2));
+}
+
+// A run is at most 64 cells, and the map is written by chunks
+void test_long_runs(){
+  CoverageGrid grid(cells, 10, 10, CELL_MM);
+  ByteSink out;
+  const uint8_t expected[] = { COVERAGE_MAP_VERSION, 10, 10, CELL_MM, 0, 63, 35 };
+  TEST_ASSERT_EQUAL(sizeof(expected), grid.encode(&out));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out.data, sizeof(expected));
+
+  // Every other column covered, one byte per cell
+  for(int32_t y = -500; y < 500; y += CELL_MM){
+    for(int32_t x = -500; x < 500; x += 2 * CELL_MM){
+      grid.mark(x, y, CellCovered);
+    }
+  }
+  out.length = 0;
+  TEST_ASSERT_EQUAL(COVERAGE_HEADER_SIZE + 100, grid.encode(&out));
+  TEST_ASSERT_EQUAL(COVERAGE_HEADER_SIZE + 100, out.length);
+  TEST_ASSERT_EQUAL_UINT8((CellCovered << 6) | 0, out.data[COVERAGE_HEADER_SIZE]);
+  TEST_ASSERT_EQUAL_UINT8((CellUnknown << 6) | 0, out.data[COVERAGE_HEADER_SIZE + 99]);
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_grid);
+  RUN_TEST(test_runs);
+  RUN_TEST(test_mark_priorities);
+  RUN_TEST(test_long_runs);
+  return UNITY_END();
+}
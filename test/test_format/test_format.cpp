@@ -0,0 +1,78 @@
+#include <unity.h>
+#include "format.h"
+
+char buffer[FIXED_BUFFER_SIZE];
+
+void setUp(){
+}
+
+void tearDown(){
+}
+
+void test_format_int(){
+  TEST_ASSERT_EQUAL(1, formatInt(buffer, 0));
+  TEST_ASSERT_EQUAL_STRING("0", buffer);
+  TEST_ASSERT_EQUAL(4, formatInt(buffer, -184));
+  TEST_ASSERT_EQUAL_STRING("-184", buffer);
+  TEST_ASSERT_EQUAL(INT_BUFFER_SIZE - 1, formatInt(buffer, INT32_MIN));
+  TEST_ASSERT_EQUAL_STRING("-2147483648", buffer);
+}
+
+void test_format_fixed(){
+  TEST_ASSERT_EQUAL(5, formatFixed(buffer, 1623, 2));
+  TEST_ASSERT_EQUAL_STRING("16.23", buffer);
+  formatFixed(buffer, 15556, 3);
+  TEST_ASSERT_EQUAL_STRING("15.556", buffer);
+  formatFixed(buffer, 42, 0);
+  TEST_ASSERT_EQUAL_STRING("42", buffer);
+}
+
+// Leading zeros are added around the point
+void test_format_fixed_small(){
+  formatFixed(buffer, 5, 2);
+  TEST_ASSERT_EQUAL_STRING("0.05", buffer);
+  formatFixed(buffer, -5, 2);
+  TEST_ASSERT_EQUAL_STRING("-0.05", buffer);
+  formatFixed(buffer, 0, 1);
+  TEST_ASSERT_EQUAL_STRING("0.0", buffer);
+}
+
+void test_format_fixed_limits(){
+  TEST_ASSERT_EQUAL(12, formatFixed(buffer, INT32_MIN, 9));
+  TEST_ASSERT_EQUAL_STRING("-2.147483648", buffer);
+  formatFixed(buffer, INT32_MAX, 9);
+  TEST_ASSERT_EQUAL_STRING("2.147483647", buffer);
+  formatFixed(buffer, 7, 9);
+  TEST_ASSERT_EQUAL_STRING("0.000000007", buffer);
+}
+
+void test_text_buffer(){
+  char text[32];
+  TextBuffer line(text, sizeof(text));
+  line.add("{\"v\":").addFixed(15556, 3).add(",\"i\":").addInt(-184).add("}");
+  TEST_ASSERT_EQUAL_STRING("{\"v\":15.556,\"i\":-184}", line.c_str());
+  TEST_ASSERT_EQUAL(strlen(text), line.length());
+  line.clear();
+  TEST_ASSERT_EQUAL(0, line.length());
+  TEST_ASSERT_EQUAL_STRING("", line.c_str());
+}
+
+void test_text_buffer_truncates(){
+  char text[8];
+  TextBuffer line(text, sizeof(text));
+  line.add("abcd").addInt(123456);
+  TEST_ASSERT_EQUAL_STRING("abcd123", line.c_str());
+  line.add("e");
+  TEST_ASSERT_EQUAL(7, line.length());
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_format_int);
+  RUN_TEST(test_format_fixed);
+  RUN_TEST(test_format_fixed_small);
+  RUN_TEST(test_format_fixed_limits);
+  RUN_TEST(test_text_buffer);
+  RUN_TEST(test_text_buffer_truncates);
+  return UNITY_END();
+}
@@ -0,0 +1,136 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <new>
+#include <PubSubClient.h>
+#include <ESP8266WiFi.h>
+#include "RoombaSim.h"
+#include "telemetry.h"
+
+/* The telemetry publish cycle must not touch the heap : the firmware is
+ * brought up against a RoombaSim, then its publish functions are called
+ * with operator new counted. The mock PubSubClient stops recording the
+ * messages so only the firmware's own allocations are seen. The free heap
+ * of the ESP can't tell, lwIP allocates and frees its buffers in the
+ * middle of a publish. */
+
+uint32_t allocations = 0;
+
+void* operator new(size_t size){
+  allocations++;
+  void* p = malloc(size ? size : 1);
+  if(p == NULL){
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size){
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+// Defined by the firmware
+void setup();
+void loop();
+void invalidateTelemetry();
+void sendMqttInfo();
+void publishDebug(const char* label, int32_t value, uint8_t decimals);
+void publishBatteryStats();
+void publishPose();
+void publishBacklogBatch();
+extern PubSubClient client;
+extern WiFiClient wifiClient;
+extern SampleRing offlineSamples;
+extern bool batteryReceived;
+
+RoombaSim* simulator;
+
+void runFor(unsigned long ms){
+  uint64_t end = mock::now() + ms * 1000ULL;
+  while(mock::now() < end){
+    loop();
+    mock::advanceMicros(1000);
+  }
+}
+
+void setUp(){
+}
+
+void tearDown(){
+}
+
+// Otherwise the other tests pass whatever the code does
+void test_allocations_are_counted(){
+  uint32_t before = allocations;
+  String text("a text too long for the small string optimisation");
+  TEST_ASSERT_TRUE(allocations > before);
+}
+
+void test_firmware_is_up(){
+  runFor(30000);
+  TEST_ASSERT_TRUE(client.connected());
+  TEST_ASSERT_TRUE(batteryReceived);
+  // The socket output grows with each publish, it is emptied without
+  // giving back its capacity
+  client.setRecording(false);
+  wifiClient.output().reserve(64 * 1024);
+}
+
+void test_telemetry(){
+  // Every metric is due, then the first publish formats each of them
+  invalidateTelemetry();
+  wifiClient.output().clear();
+  uint32_t before = allocations;
+  sendMqttInfo();
+  TEST_ASSERT_EQUAL_UINT32(before, allocations);
+  TEST_ASSERT_TRUE(wifiClient.output().size() > 0);
+}
+
+void test_debug_stats_and_pose(){
+  wifiClient.output().clear();
+  uint32_t before = allocations;
+  publishDebug("Sensor timeouts", 3, 0);
+  publishBatteryStats();
+  publishPose();
+  TEST_ASSERT_EQUAL_UINT32(before, allocations);
+  TEST_ASSERT_TRUE(wifiClient.output().size() > 0);
+}
+
+void test_backlog(){
+  // Offline, sendMqttInfo() buffers a sample at each interval
+  client.setBrokerReachable(false);
+  for(uint8_t i = 0; i < 4; i++){
+    // Longer than TIME_BETWEEN_OFFLINE_SAMPLES
+    mock::advanceMillis(60000);
+    sendMqttInfo();
+  }
+  TEST_ASSERT_TRUE(offlineSamples.size() > 0);
+  client.setBrokerReachable(true);
+  TEST_ASSERT_TRUE(client.connect("test"));
+  uint16_t buffered = offlineSamples.size();
+
+  wifiClient.output().clear();
+  uint32_t before = allocations;
+  publishBacklogBatch();
+  TEST_ASSERT_EQUAL_UINT32(before, allocations);
+  TEST_ASSERT_TRUE(offlineSamples.size() < buffered);
+}
+
+int main(int argc, char** argv){
+  simulator = new RoombaSim(Serial);
+  setup();
+  UNITY_BEGIN();
+  RUN_TEST(test_allocations_are_counted);
+  RUN_TEST(test_firmware_is_up);
+  RUN_TEST(test_telemetry);
+  RUN_TEST(test_debug_stats_and_pose);
+  RUN_TEST(test_backlog);
+  return UNITY_END();
+}
@@ -0,0 +1,81 @@
+#include <unity.h>
+#include "loop_metrics.h"
+
+StageMetrics* metrics;
+
+void setUp(){
+  metrics = new StageMetrics();
+}
+
+void tearDown(){
+  delete metrics;
+}
+
+void test_empty(){
+  char text[96];
+  metrics->format(text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("{\"n\":0,\"max\":0,\"h\":[0,0,0,0,0,0,0,0]}", text);
+}
+
+// A bucket holds the times below its limit, the limit goes to the next one
+void test_buckets(){
+  metrics->record(0);
+  metrics->record(49);
+  metrics->record(50);
+  metrics->record(999);
+  metrics->record(1000);
+  metrics->record(499999);
+  metrics->record(500000);
+  metrics->record(3000000);
+  char text[96];
+  metrics->format(text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("{\"n\":8,\"max\":3000000,\"h\":[2,1,1,1,0,0,1,2]}", text);
+  TEST_ASSERT_EQUAL_UINT32(8, metrics->count());
+  TEST_ASSERT_EQUAL_UINT32(3000000, metrics->max());
+}
+
+void test_reset(){
+  metrics->record(120);
+  metrics->record(7000);
+  metrics->reset();
+  TEST_ASSERT_EQUAL_UINT32(0, metrics->count());
+  TEST_ASSERT_EQUAL_UINT32(0, metrics->max());
+  metrics->record(10);
+  TEST_ASSERT_EQUAL_UINT32(10, metrics->max());
+}
+
+// Cut at the end of the buffer, still terminated
+void test_format_truncated(){
+  char text[12];
+  metrics->format(text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("{\"n\":0,\"max", text);
+}
+
+void test_stage_timer(){
+  {
+    StageTimer timer(metrics);
+    mock::advanceMicros(300);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, metrics->count());
+  // Reading the clock takes 1 us
+  TEST_ASSERT_UINT32_WITHIN(2, 301, metrics->max());
+}
+
+void test_stage_timer_disabled(){
+  {
+    StageTimer timer(NULL);
+    mock::advanceMicros(300);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, metrics->count());
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_buckets);
+  RUN_TEST(test_reset);
+  RUN_TEST(test_format_truncated);
+  RUN_TEST(test_stage_timer);
+  RUN_TEST(test_stage_timer_disabled);
+  return UNITY_END();
+}
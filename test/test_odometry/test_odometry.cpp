@@ -0,0 +1,120 @@
+#include <unity.h>
+#include <math.h>
+#include "odometry.h"
+
+Odometry* pose;
+
+void setUp(){
+  pose = new Odometry();
+}
+
+void tearDown(){
+  delete pose;
+}
+
+void test_straight(){
+  pose->update(1000, 0);
+  TEST_ASSERT_EQUAL_INT32(1000, pose->xMm());
+  TEST_ASSERT_EQUAL_INT32(0, pose->yMm());
+  pose->update(-1500, 0);
+  TEST_ASSERT_EQUAL_INT32(-500, pose->xMm());
+  TEST_ASSERT_EQUAL_INT16(0, pose->headingDeg());
+}
+
+void test_heading_wraps(){
+  pose->update(0, 90);
+  TEST_ASSERT_EQUAL_INT16(90, pose->headingDeg());
+  pose->update(0, -180);
+  TEST_ASSERT_EQUAL_INT16(270, pose->headingDeg());
+  pose->update(0, 450);
+  TEST_ASSERT_EQUAL_INT16(0, pose->headingDeg());
+  TEST_ASSERT_EQUAL_INT32(0, pose->xMm());
+}
+
+// A step is projected on the heading at its middle
+void test_step_on_middle_heading(){
+  pose->update(100, 90);
+  TEST_ASSERT_EQUAL_INT32(71, pose->xMm());
+  TEST_ASSERT_EQUAL_INT32(71, pose->yMm());
+  TEST_ASSERT_EQUAL_INT16(90, pose->headingDeg());
+  pose->update(100, 0);
+  TEST_ASSERT_EQUAL_INT32(71, pose->xMm());
+  TEST_ASSERT_EQUAL_INT32(171, pose->yMm());
+}
+
+// A 1 m square counter clockwise then clockwise comes back to the origin
+void test_square_closes(){
+  for(uint8_t i = 0; i < 4; i++){
+    pose->update(1000, 0);
+    pose->update(0, 90);
+  }
+  TEST_ASSERT_EQUAL_INT32(0, pose->xMm());
+  TEST_ASSERT_EQUAL_INT32(0, pose->yMm());
+  for(uint8_t i = 0; i < 4; i++){
+    pose->update(1000, 0);
+    pose->update(0, -90);
+  }
+  TEST_ASSERT_EQUAL_INT32(0, pose->xMm());
+  TEST_ASSERT_EQUAL_INT32(0, pose->yMm());
+}
+
+// Small steps of a cleaning run add up without drifting from the same
+// model in floating point
+void test_matches_floating_point(){
+  double x = 0;
+  double y = 0;
+  int32_t heading = 0;
+  srand(17);
+  for(uint16_t i = 0; i < 5000; i++){
+    int16_t distance = rand() % 11 - 2;
+    int16_t angle = rand() % 7 - 3;
+    double middle = (heading + angle / 2.0) * M_PI / 180;
+    x += distance * cos(middle);
+    y += distance * sin(middle);
+    heading += angle;
+    pose->update(distance, angle);
+  }
+  TEST_ASSERT_INT32_WITHIN(2, lround(x), pose->xMm());
+  TEST_ASSERT_INT32_WITHIN(2, lround(y), pose->yMm());
+  TEST_ASSERT_EQUAL_INT16(((heading % 360) + 360) % 360, pose->headingDeg());
+}
+
+// 100 m away in steps of a frame, still in range
+void test_long_run(){
+  for(uint16_t i = 0; i < 10000; i++){
+    pose->update(10, 0);
+  }
+  TEST_ASSERT_EQUAL_INT32(100000, pose->xMm());
+}
+
+void test_project(){
+  pose->update(0, 90);
+  pose->update(500, 0);
+  int32_t x;
+  int32_t y;
+  // 200 mm ahead and 100 mm to the left of a robot facing +y
+  pose->project(200, 100, x, y);
+  TEST_ASSERT_EQUAL_INT32(-100, x);
+  TEST_ASSERT_EQUAL_INT32(700, y);
+}
+
+void test_reset(){
+  pose->update(300, 45);
+  pose->reset();
+  TEST_ASSERT_EQUAL_INT32(0, pose->xMm());
+  TEST_ASSERT_EQUAL_INT32(0, pose->yMm());
+  TEST_ASSERT_EQUAL_INT16(0, pose->headingDeg());
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_straight);
+  RUN_TEST(test_heading_wraps);
+  RUN_TEST(test_step_on_middle_heading);
+  RUN_TEST(test_square_closes);
+  RUN_TEST(test_matches_floating_point);
+  RUN_TEST(test_long_run);
+  RUN_TEST(test_project);
+  RUN_TEST(test_reset);
+  return UNITY_END();
+}
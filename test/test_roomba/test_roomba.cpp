@@ -0,0 +1,230 @@
+#include <unity.h>
+#include <Roomba.h>
+
+// Nothing attached, what the driver writes is kept in output()
+HardwareSerial* port;
+Roomba* robot;
+
+uint8_t callbackPacket;
+int8_t callbackOk;
+
+void onTransaction(uint8_t packetID, bool ok){
+  callbackPacket = packetID;
+  callbackOk = ok;
+}
+
+void setUp(){
+  port = new HardwareSerial();
+  robot = new Roomba(port, Roomba::Baud115200);
+  robot->start();
+  port->output().clear();
+  callbackPacket = 0xff;
+  callbackOk = -1;
+}
+
+void tearDown(){
+  delete robot;
+  delete port;
+}
+
+// Answers the pending request after latencyMs
+Roomba::TransactionState reply(const uint8_t* data, size_t length, unsigned long latencyMs){
+  mock::advanceMillis(latencyMs);
+  port->inject(data, length);
+  return robot->pollTransaction();
+}
+
+void test_request_and_reply(){
+  uint8_t dest[2];
+  TEST_ASSERT_TRUE(robot->requestSensors(Roomba::SensorVoltage, dest, sizeof(dest), onTransaction));
+  const uint8_t request[] = { 142, Roomba::SensorVoltage };
+  TEST_ASSERT_EQUAL(sizeof(request), port->output().size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(request, port->output().data(), sizeof(request));
+  TEST_ASSERT_TRUE(robot->transactionPending());
+  TEST_ASSERT_EQUAL(Roomba::TransactionPending, robot->pollTransaction());
+
+  // One transaction at a time
+  TEST_ASSERT_FALSE(robot->requestSensors(Roomba::SensorCurrent, dest, sizeof(dest)));
+
+  const uint8_t voltage[] = { 0x3c, 0xc3 };
+  TEST_ASSERT_EQUAL(Roomba::TransactionPending, reply(voltage, 1, 5));
+  TEST_ASSERT_EQUAL(Roomba::TransactionDone, reply(voltage + 1, 1, 0));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(voltage, dest, sizeof(voltage));
+  TEST_ASSERT_EQUAL_UINT8(Roomba::SensorVoltage, callbackPacket);
+  TEST_ASSERT_EQUAL(1, callbackOk);
+  TEST_ASSERT_FALSE(robot->transactionPending());
+  TEST_ASSERT_EQUAL(Roomba::TransactionIdle, robot->pollTransaction());
+
+  const Roomba::TransactionStats& stats = robot->transactionStats(Roomba::SensorVoltage);
+  TEST_ASSERT_EQUAL_UINT16(1, stats.completed);
+  TEST_ASSERT_EQUAL_UINT16(0, stats.timeouts);
+  TEST_ASSERT_INT_WITHIN(100, 5000, stats.latency);
+}
+
+void test_timeout(){
+  uint8_t dest[2];
+  robot->requestSensors(Roomba::SensorCurrent, dest, sizeof(dest), onTransaction);
+  TEST_ASSERT_EQUAL_UINT16(ROOMBA_READ_TIMEOUT, robot->transactionTimeout(Roomba::SensorCurrent));
+  mock::advanceMillis(ROOMBA_READ_TIMEOUT - 1);
+  TEST_ASSERT_EQUAL(Roomba::TransactionPending, robot->pollTransaction());
+  mock::advanceMillis(2);
+  TEST_ASSERT_EQUAL(Roomba::TransactionTimeout, robot->pollTransaction());
+  TEST_ASSERT_EQUAL(0, callbackOk);
+  TEST_ASSERT_EQUAL_UINT16(1, robot->transactionStats(Roomba::SensorCurrent).timeouts);
+  // The next one can start
+  TEST_ASSERT_TRUE(robot->requestSensors(Roomba::SensorCurrent, dest, sizeof(dest)));
+}
+
+// Bytes received before the request are not part of the reply
+void test_stale_input_discarded(){
+  const uint8_t stale[] = { 1, 2, 3 };
+  port->inject(stale, sizeof(stale));
+  mock::advanceMillis(1);
+  uint8_t dest[1];
+  robot->requestSensors(Roomba::SensorOIMode, dest, sizeof(dest));
+  TEST_ASSERT_EQUAL(Roomba::TransactionPending, robot->pollTransaction());
+  const uint8_t mode[] = { 2 };
+  TEST_ASSERT_EQUAL(Roomba::TransactionDone, reply(mode, 1, 2));
+  TEST_ASSERT_EQUAL_UINT8(2, dest[0]);
+}
+
+// The timeout follows the measured latency, within the fixed bounds
+void test_adaptive_timeout(){
+  uint8_t dest[1];
+  const uint8_t data[] = { 0 };
+  robot->requestSensors(Roomba::SensorChargingState, dest, sizeof(dest));
+  reply(data, 1, 50);
+  // 50 ms and a deviation of half of it
+  TEST_ASSERT_INT_WITHIN(2, 151, robot->transactionTimeout(Roomba::SensorChargingState));
+  for(uint8_t i = 0; i < 40; i++){
+    robot->requestSensors(Roomba::SensorChargingState, dest, sizeof(dest));
+    reply(data, 1, 50);
+  }
+  uint16_t timeout = robot->transactionTimeout(Roomba::SensorChargingState);
+  TEST_ASSERT_TRUE(timeout > 50 && timeout < 60);
+
+  // Fast replies still wait at least one 15 ms OI cycle
+  for(uint8_t i = 0; i < 40; i++){
+    robot->requestSensors(Roomba::SensorChargingState, dest, sizeof(dest));
+    reply(data, 1, 1);
+  }
+  TEST_ASSERT_EQUAL_UINT16(ROOMBA_MIN_READ_TIMEOUT, robot->transactionTimeout(Roomba::SensorChargingState));
+  // Other packets keep their own statistics
+  TEST_ASSERT_EQUAL_UINT16(ROOMBA_READ_TIMEOUT, robot->transactionTimeout(Roomba::SensorVoltage));
+}
+
+void test_sensors_list(){
+  uint8_t ids[] = { Roomba::SensorChargingState, Roomba::SensorOIMode };
+  uint8_t dest[2];
+  TEST_ASSERT_TRUE(robot->requestSensorsList(ids, 2, dest, sizeof(dest), onTransaction));
+  const uint8_t request[] = { 149, 2, Roomba::SensorChargingState, Roomba::SensorOIMode };
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(request, port->output().data(), sizeof(request));
+  const uint8_t data[] = { 1, 3 };
+  TEST_ASSERT_EQUAL(Roomba::TransactionDone, reply(data, 2, 3));
+  TEST_ASSERT_EQUAL_UINT8(ROOMBA_STATS_SENSORS_LIST, callbackPacket);
+  TEST_ASSERT_EQUAL_UINT16(1, robot->transactionStats(ROOMBA_STATS_SENSORS_LIST).completed);
+}
+
+// The callback may start the next transaction
+uint8_t chainedDest[1];
+
+void chainNext(uint8_t packetID, bool ok){
+  robot->requestSensors(Roomba::SensorOIMode, chainedDest, sizeof(chainedDest));
+}
+
+void test_callback_starts_next(){
+  uint8_t dest[1];
+  robot->requestSensors(Roomba::SensorChargingState, dest, sizeof(dest), chainNext);
+  const uint8_t data[] = { 1 };
+  TEST_ASSERT_EQUAL(Roomba::TransactionDone, reply(data, 1, 2));
+  TEST_ASSERT_TRUE(robot->transactionPending());
+  TEST_ASSERT_EQUAL(Roomba::TransactionDone, reply(data, 1, 2));
+}
+
+// Only the commands missing from the tracked mode are sent
+void test_ensure_mode_transitions(){
+  TEST_ASSERT_FALSE(robot->ensureMode(Roomba::ModePassive));
+  TEST_ASSERT_EQUAL(0, port->output().size());
+
+  TEST_ASSERT_TRUE(robot->ensureMode(Roomba::ModeSafe));
+  const uint8_t safe[] = { 131 };
+  TEST_ASSERT_EQUAL(sizeof(safe), port->output().size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(safe, port->output().data(), sizeof(safe));
+  port->output().clear();
+
+  // Full from safe without start()
+  TEST_ASSERT_TRUE(robot->ensureMode(Roomba::ModeFull));
+  const uint8_t full[] = { 132 };
+  TEST_ASSERT_EQUAL(sizeof(full), port->output().size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(full, port->output().data(), sizeof(full));
+  TEST_ASSERT_FALSE(robot->ensureMode(Roomba::ModeFull));
+  port->output().clear();
+
+  TEST_ASSERT_TRUE(robot->ensureMode(Roomba::ModePassive));
+  const uint8_t passive[] = { 128 };
+  TEST_ASSERT_EQUAL(sizeof(passive), port->output().size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(passive, port->output().data(), sizeof(passive));
+  TEST_ASSERT_EQUAL(Roomba::ModePassive, robot->mode());
+}
+
+void test_ensure_mode_unknown(){
+  robot->invalidateMode();
+  TEST_ASSERT_FALSE(robot->modeKnown());
+  TEST_ASSERT_EQUAL(Roomba::ModeOff, robot->mode());
+  TEST_ASSERT_TRUE(robot->ensureMode(Roomba::ModeSafe));
+  const uint8_t safe[] = { 128, 131 };
+  TEST_ASSERT_EQUAL(sizeof(safe), port->output().size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(safe, port->output().data(), sizeof(safe));
+  TEST_ASSERT_TRUE(robot->modeKnown());
+  TEST_ASSERT_EQUAL(Roomba::ModeSafe, robot->mode());
+}
+
+// Reports sampled before the robot applied a mode command are ignored
+void test_mode_observed_after_settle_time(){
+  robot->ensureMode(Roomba::ModeSafe);
+  mock::advanceMillis(ROOMBA_MODE_SETTLE_TIME / 2);
+  robot->modeObserved(Roomba::ModePassive);
+  TEST_ASSERT_EQUAL(Roomba::ModeSafe, robot->mode());
+
+  // Left safe mode by itself, on a cliff or the dock
+  mock::advanceMillis(ROOMBA_MODE_SETTLE_TIME);
+  robot->modeObserved(Roomba::ModePassive);
+  TEST_ASSERT_EQUAL(Roomba::ModePassive, robot->mode());
+  port->output().clear();
+  TEST_ASSERT_TRUE(robot->ensureMode(Roomba::ModeSafe));
+  TEST_ASSERT_EQUAL(1, port->output().size());
+  TEST_ASSERT_EQUAL_UINT8(131, port->output()[0]);
+}
+
+// The OI off ignores everything but start()
+void test_mode_observed_off(){
+  mock::advanceMillis(ROOMBA_MODE_SETTLE_TIME);
+  robot->modeObserved(Roomba::ModeOff);
+  TEST_ASSERT_TRUE(robot->modeKnown());
+  TEST_ASSERT_TRUE(robot->ensureMode(Roomba::ModeFull));
+  const uint8_t full[] = { 128, 132 };
+  TEST_ASSERT_EQUAL(sizeof(full), port->output().size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(full, port->output().data(), sizeof(full));
+}
+
+void test_mode_observed_corrupted(){
+  mock::advanceMillis(ROOMBA_MODE_SETTLE_TIME);
+  robot->modeObserved(200);
+  TEST_ASSERT_EQUAL(Roomba::ModePassive, robot->mode());
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_request_and_reply);
+  RUN_TEST(test_timeout);
+  RUN_TEST(test_stale_input_discarded);
+  RUN_TEST(test_adaptive_timeout);
+  RUN_TEST(test_sensors_list);
+  RUN_TEST(test_callback_starts_next);
+  RUN_TEST(test_ensure_mode_transitions);
+  RUN_TEST(test_ensure_mode_unknown);
+  RUN_TEST(test_mode_observed_after_settle_time);
+  RUN_TEST(test_mode_observed_off);
+  RUN_TEST(test_mode_observed_corrupted);
+  return UNITY_END();
+}
@@ -0,0 +1,165 @@
+#include <unity.h>
+#include <limits.h>
+#include "scheduler.h"
+
+// Actions record the order they ran in
+char ran[8];
+uint8_t ranCount = 0;
+Sequence sequence;
+
+void stepA(){
+  ran[ranCount++] = 'a';
+}
+
+void stepB(){
+  ran[ranCount++] = 'b';
+}
+
+void stepSkip(){
+  ran[ranCount++] = 's';
+  sequence.skipWait();
+}
+
+void setUp(){
+  memset(ran, 0, sizeof(ran));
+  ranCount = 0;
+  sequence.cancel();
+}
+
+void tearDown(){
+}
+
+void test_periodic_fires_first_then_each_interval(){
+  Periodic timer(1000);
+  TEST_ASSERT_TRUE(timer.due(5));
+  TEST_ASSERT_FALSE(timer.due(6));
+  TEST_ASSERT_FALSE(timer.due(1004));
+  TEST_ASSERT_TRUE(timer.due(1005));
+  TEST_ASSERT_FALSE(timer.due(2000));
+}
+
+void test_periodic_reset(){
+  Periodic timer(1000);
+  timer.reset(500);
+  TEST_ASSERT_FALSE(timer.due(1000));
+  TEST_ASSERT_TRUE(timer.due(1500));
+}
+
+void test_periodic_millis_overflow(){
+  Periodic timer(1000);
+  timer.reset(ULONG_MAX - 0xff);
+  TEST_ASSERT_FALSE(timer.due(0x100));
+  TEST_ASSERT_TRUE(timer.due(0x2e8));
+}
+
+void test_sequence_waits_between_steps(){
+  const Step steps[] = { {stepA, 100}, {stepB, 50} };
+  sequence.start(steps, 2);
+  TEST_ASSERT_TRUE(sequence.busy());
+  sequence.run(1000);
+  TEST_ASSERT_EQUAL_STRING("a", ran);
+  sequence.run(1099);
+  TEST_ASSERT_EQUAL_STRING("a", ran);
+  sequence.run(1100);
+  TEST_ASSERT_EQUAL_STRING("ab", ran);
+  // Busy until the wait after the last step is over
+  sequence.run(1149);
+  TEST_ASSERT_TRUE(sequence.busy());
+  sequence.run(1150);
+  TEST_ASSERT_FALSE(sequence.busy());
+  sequence.run(2000);
+  TEST_ASSERT_EQUAL_STRING("ab", ran);
+}
+
+// One step per run() even without waits
+void test_sequence_skip_wait(){
+  const Step steps[] = { {stepSkip, 1000}, {NULL, 0}, {stepB, 0} };
+  sequence.start(steps, 3);
+  sequence.run(0);
+  TEST_ASSERT_EQUAL_STRING("s", ran);
+  sequence.run(1);
+  sequence.run(2);
+  TEST_ASSERT_EQUAL_STRING("sb", ran);
+  sequence.run(3);
+  TEST_ASSERT_FALSE(sequence.busy());
+}
+
+void test_sequence_cancel_and_restart(){
+  const Step first[] = { {stepA, 100}, {stepA, 0} };
+  const Step second[] = { {stepB, 0} };
+  sequence.start(first, 2);
+  sequence.run(0);
+  sequence.start(second, 1);
+  sequence.run(1);
+  TEST_ASSERT_EQUAL_STRING("ab", ran);
+  sequence.start(first, 2);
+  sequence.cancel();
+  TEST_ASSERT_FALSE(sequence.busy());
+  sequence.run(500);
+  TEST_ASSERT_EQUAL_STRING("ab", ran);
+}
+
+// Time from a failure at now to the next due attempt, in ms
+unsigned long backoffWait(const Backoff& backoff, unsigned long now){
+  unsigned long wait = 0;
+  while(!backoff.due(now + wait)){
+    wait++;
+  }
+  return wait;
+}
+
+void test_backoff_due_at_first(){
+  Backoff backoff(1000, 8000);
+  TEST_ASSERT_TRUE(backoff.due(0));
+  TEST_ASSERT_TRUE(backoff.due(12345));
+}
+
+// Between half and all of the delay, which doubles up to the max
+void test_backoff_doubles_up_to_max(){
+  Backoff backoff(1000, 8000);
+  const unsigned long delays[] = { 1000, 2000, 4000, 8000, 8000, 8000 };
+  unsigned long now = 5000;
+  for(uint8_t i = 0; i < sizeof(delays) / sizeof(delays[0]); i++){
+    backoff.failed(now);
+    TEST_ASSERT_FALSE(backoff.due(now));
+    unsigned long wait = backoffWait(backoff, now);
+    TEST_ASSERT_TRUE(wait >= delays[i] / 2);
+    TEST_ASSERT_TRUE(wait <= delays[i]);
+    now += wait;
+  }
+}
+
+void test_backoff_succeeded_resets(){
+  Backoff backoff(1000, 8000);
+  for(uint8_t i = 0; i < 4; i++){
+    backoff.failed(0);
+  }
+  backoff.succeeded();
+  TEST_ASSERT_TRUE(backoff.due(0));
+  backoff.failed(100);
+  TEST_ASSERT_TRUE(backoffWait(backoff, 100) <= 1000);
+}
+
+void test_backoff_millis_overflow(){
+  Backoff backoff(1000, 8000);
+  unsigned long now = ULONG_MAX - 200;
+  backoff.failed(now);
+  unsigned long wait = backoffWait(backoff, now);
+  TEST_ASSERT_TRUE(wait >= 500 && wait <= 1000);
+  TEST_ASSERT_TRUE(backoff.due(now + 1000));
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_periodic_fires_first_then_each_interval);
+  RUN_TEST(test_periodic_reset);
+  RUN_TEST(test_periodic_millis_overflow);
+  RUN_TEST(test_sequence_waits_between_steps);
+  RUN_TEST(test_sequence_skip_wait);
+  RUN_TEST(test_sequence_cancel_and_restart);
+  RUN_TEST(test_backoff_due_at_first);
+  RUN_TEST(test_backoff_doubles_up_to_max);
+  RUN_TEST(test_backoff_succeeded_resets);
+  RUN_TEST(test_backoff_millis_overflow);
+  return UNITY_END();
+}
@@ -0,0 +1,97 @@
+#include <unity.h>
+#include "sensors.h"
+
+void setUp(){
+}
+
+void tearDown(){
+}
+
+// Too few packets of a group to be worth its other bytes
+void test_plan_singles(){
+  typedef SensorPlan<sensorSet(Roomba::SensorVoltage, Roomba::SensorCurrent)> Plan;
+  Plan plan;
+  TEST_ASSERT_EQUAL_UINT8(0, Plan::GROUPS);
+  TEST_ASSERT_EQUAL_UINT8(2, Plan::COUNT);
+  TEST_ASSERT_EQUAL_UINT8(6, Plan::FRAME_SIZE);
+  TEST_ASSERT_EQUAL_UINT8(4, Plan::REPLY_SIZE);
+  TEST_ASSERT_EQUAL_UINT8(Roomba::SensorVoltage, plan.packets[0]);
+  TEST_ASSERT_EQUAL_UINT8(Roomba::SensorCurrent, plan.packets[1]);
+}
+
+// The battery packets 21 to 26 cost less as their group
+void test_plan_group(){
+  typedef SensorPlan<sensorSet(Roomba::SensorChargingState, Roomba::SensorVoltage, Roomba::SensorCurrent,
+                               Roomba::SensorBatteryCharge, Roomba::SensorBatteryCapacity)> Plan;
+  Plan plan;
+  TEST_ASSERT_EQUAL_UINT8(1 << Roomba::Sensors21to26, Plan::GROUPS);
+  TEST_ASSERT_EQUAL_UINT8(1, Plan::COUNT);
+  TEST_ASSERT_EQUAL_UINT8(11, Plan::FRAME_SIZE);
+  TEST_ASSERT_EQUAL_UINT8(10, Plan::REPLY_SIZE);
+  TEST_ASSERT_EQUAL_UINT8(Roomba::Sensors21to26, plan.packets[0]);
+}
+
+// Groups come first, then the packets they don't cover
+void test_plan_group_and_singles(){
+  typedef SensorPlan<sensorSet(Roomba::SensorChargingState, Roomba::SensorVoltage, Roomba::SensorCurrent,
+                               Roomba::SensorBatteryCharge, Roomba::SensorBatteryCapacity,
+                               Roomba::SensorOIMode)> Plan;
+  Plan plan;
+  TEST_ASSERT_EQUAL_UINT8(2, Plan::COUNT);
+  TEST_ASSERT_EQUAL_UINT8(13, Plan::FRAME_SIZE);
+  TEST_ASSERT_EQUAL_UINT8(Roomba::Sensors21to26, plan.packets[0]);
+  TEST_ASSERT_EQUAL_UINT8(Roomba::SensorOIMode, plan.packets[1]);
+}
+
+void test_plan_everything(){
+  SensorSet all = 0;
+  for(uint8_t id = FIRST_SENSOR_PACKET; id <= LAST_SENSOR_PACKET; id++){
+    all |= sensorSet(id);
+  }
+  uint8_t groups = sensorPlanGroups(all);
+  TEST_ASSERT_EQUAL_UINT8(1 << Roomba::Sensors7to42, groups);
+  TEST_ASSERT_EQUAL_UINT16(53, sensorPlanCost(all, groups));
+}
+
+void test_decode_sensor(){
+  const uint8_t current[] = { 0xff, 0x48 };
+  TEST_ASSERT_EQUAL_INT32(-184, decodeSensor(Roomba::SensorCurrent, current));
+  const uint8_t voltage[] = { 0x3c, 0xc3 };
+  TEST_ASSERT_EQUAL_INT32(15555, decodeSensor(Roomba::SensorVoltage, voltage));
+  const uint8_t temperature[] = { 0xfe };
+  TEST_ASSERT_EQUAL_INT32(-2, decodeSensor(Roomba::SensorBatteryTemperature, temperature));
+}
+
+// Groups are split into their packets, values out of range are rejected
+void test_decode_reply(){
+  const uint8_t ids[] = { Roomba::Sensors21to26, Roomba::SensorOIMode };
+  const uint8_t reply[] = { 2, 0x75, 0x30, 0xff, 0x48, 25, 0x07, 0xd0, 0x0a, 0x8c, 3 };
+  SensorReadings readings;
+  TEST_ASSERT_TRUE(readings.decodeReply(ids, 2, reply, sizeof(reply)));
+  TEST_ASSERT_TRUE(readings.has(Roomba::SensorChargingState));
+  TEST_ASSERT_EQUAL_INT32(2, readings.value(Roomba::SensorChargingState));
+  TEST_ASSERT_EQUAL_INT32(-184, readings.value(Roomba::SensorCurrent));
+  TEST_ASSERT_EQUAL_INT32(2000, readings.value(Roomba::SensorBatteryCharge));
+  TEST_ASSERT_EQUAL_INT32(2700, readings.value(Roomba::SensorBatteryCapacity));
+  TEST_ASSERT_EQUAL_INT32(3, readings.value(Roomba::SensorOIMode));
+  // 30 V
+  TEST_ASSERT_FALSE(readings.has(Roomba::SensorVoltage));
+  TEST_ASSERT_TRUE(readings.received(sensorSet(Roomba::SensorVoltage)));
+  TEST_ASSERT_TRUE(readings.rejected() == sensorSet(Roomba::SensorVoltage));
+  TEST_ASSERT_FALSE(readings.has(Roomba::SensorWall));
+
+  readings.clear();
+  TEST_ASSERT_FALSE(readings.has(Roomba::SensorCurrent));
+  TEST_ASSERT_FALSE(readings.decodeReply(ids, 2, reply, sizeof(reply) - 1));
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_plan_singles);
+  RUN_TEST(test_plan_group);
+  RUN_TEST(test_plan_group_and_singles);
+  RUN_TEST(test_plan_everything);
+  RUN_TEST(test_decode_sensor);
+  RUN_TEST(test_decode_reply);
+  return UNITY_END();
+}
@@ -0,0 +1,158 @@
+#include <unity.h>
+#include "songs.h"
+
+// 64 ticks, 1 s
+constexpr uint8_t firstNotes[] PROGMEM = { 60, 32, 64, 32 };
+// 250 ms
+constexpr uint8_t secondNotes[] PROGMEM = { 67, 16 };
+constexpr Song firstPart = makeSong<0>(firstNotes);
+constexpr Song secondPart = makeSong<1>(secondNotes);
+const Song* const tune[] = { &firstPart, &secondPart };
+
+// Nothing attached, what the player sends is kept in output()
+HardwareSerial* port;
+Roomba* robot;
+SongPlayer* player;
+
+void setUp(){
+  port = new HardwareSerial();
+  robot = new Roomba(port, Roomba::Baud115200);
+  robot->start();
+  port->output().clear();
+  player = new SongPlayer(*robot);
+}
+
+void tearDown(){
+  delete player;
+  delete robot;
+  delete port;
+}
+
+// Runs the player from loop() for ms
+void runFor(unsigned long ms){
+  unsigned long end = millis() + ms;
+  while(millis() < end){
+    player->run(millis());
+    mock::advanceMillis(1);
+  }
+}
+
+uint8_t playCommands(){
+  uint8_t count = 0;
+  std::vector<uint8_t>& output = port->output();
+  for(size_t i = 0; i + 1 < output.size(); i++){
+    if(output[i] == 141){
+      count++;
+      i++;
+    }
+  }
+  return count;
+}
+
+void test_play_uploads_then_plays(){
+  player->play(tune, 2);
+  TEST_ASSERT_TRUE(player->busy());
+  runFor(2000);
+  // Full mode, each part uploaded then played, back to passive
+  const uint8_t expected[] = {
+    132,
+    140, 0, 2, 60, 32, 64, 32,
+    141, 0,
+    140, 1, 1, 67, 16,
+    141, 1,
+    128
+  };
+  TEST_ASSERT_EQUAL(sizeof(expected), port->output().size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, port->output().data(), sizeof(expected));
+  TEST_ASSERT_FALSE(player->busy());
+  TEST_ASSERT_EQUAL(Roomba::ModePassive, robot->mode());
+}
+
+// The next part only starts once the first one is over
+void test_parts_follow_each_other(){
+  player->play(tune, 2);
+  runFor(1100);
+  TEST_ASSERT_EQUAL_UINT8(1, playCommands());
+  runFor(100);
+  TEST_ASSERT_EQUAL_UINT8(2, playCommands());
+  TEST_ASSERT_TRUE(player->busy());
+  runFor(300);
+  TEST_ASSERT_FALSE(player->busy());
+}
+
+void test_replay_skips_upload(){
+  player->play(tune, 2);
+  runFor(2000);
+  port->output().clear();
+  player->play(tune, 2);
+  runFor(2000);
+  const uint8_t expected[] = { 132, 141, 0, 141, 1, 128 };
+  TEST_ASSERT_EQUAL(sizeof(expected), port->output().size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, port->output().data(), sizeof(expected));
+}
+
+void test_invalidate_uploads_again(){
+  player->play(tune, 2);
+  runFor(2000);
+  port->output().clear();
+  player->invalidate();
+  player->play(tune, 2);
+  runFor(2000);
+  TEST_ASSERT_EQUAL(18, port->output().size());
+  TEST_ASSERT_EQUAL_UINT8(140, port->output()[1]);
+}
+
+void test_stop(){
+  player->play(tune, 2);
+  runFor(150);
+  TEST_ASSERT_EQUAL_UINT8(1, playCommands());
+  player->stop();
+  TEST_ASSERT_FALSE(player->busy());
+  port->output().clear();
+  runFor(2000);
+  TEST_ASSERT_EQUAL(0, port->output().size());
+}
+
+// Already in full mode, the upload doesn't wait for the mode change
+void test_no_mode_wait_in_full_mode(){
+  robot->fullMode();
+  port->output().clear();
+  player->play(tune, 2);
+  runFor(5);
+  TEST_ASSERT_TRUE(port->output().size() > 0);
+  TEST_ASSERT_EQUAL_UINT8(140, port->output()[0]);
+}
+
+void test_make_song(){
+  TEST_ASSERT_EQUAL_UINT8(0, firstPart.slot);
+  TEST_ASSERT_EQUAL_PTR(firstNotes, firstPart.notes);
+  TEST_ASSERT_EQUAL_UINT8(4, firstPart.length);
+  TEST_ASSERT_EQUAL_UINT32(1000, firstPart.durationMs);
+  TEST_ASSERT_EQUAL_UINT8(1, secondPart.slot);
+  TEST_ASSERT_EQUAL_UINT32(250, secondPart.durationMs);
+}
+
+// Computed at compile time
+static_assert(songTicks(firstNotes, sizeof(firstNotes)) == 64, "Sum of the durations");
+static_assert(makeSong<4>(secondNotes).slot == 4, "Last slot of the 500 and 600 series");
+
+// Rounded up, the next part never starts on the last note
+void test_duration_rounding(){
+  TEST_ASSERT_EQUAL_UINT32(0, songTicksToMs(0));
+  TEST_ASSERT_EQUAL_UINT32(16, songTicksToMs(1));
+  TEST_ASSERT_EQUAL_UINT32(47, songTicksToMs(3));
+  TEST_ASSERT_EQUAL_UINT32(4000, songTicksToMs(256));
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_play_uploads_then_plays);
+  RUN_TEST(test_parts_follow_each_other);
+  RUN_TEST(test_replay_skips_upload);
+  RUN_TEST(test_invalidate_uploads_again);
+  RUN_TEST(test_stop);
+  RUN_TEST(test_no_mode_wait_in_full_mode);
+  RUN_TEST(test_make_song);
+  RUN_TEST(test_duration_rounding);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+#include <unity.h>
+#include "stream_parser.h"
+
+uint8_t buffer[32];
+StreamParser parser(buffer, sizeof(buffer));
+
+// Charging state 2 and voltage 16000 mV, then the checksum
+const uint8_t FRAME[] = { 19, 5, 21, 2, 22, 0x3e, 0x80, 0 };
+const uint8_t PAYLOAD_SIZE = 5;
+
+void setUp(){
+  parser.expect(0);
+  parser.reset();
+  parser.resetStats();
+}
+
+void tearDown(){
+}
+
+// Fills the checksum so all the bytes add up to 0
+void seal(uint8_t* frame, uint8_t length){
+  uint8_t sum = 0;
+  for(uint8_t i = 0; i < length - 1; i++){
+    sum += frame[i];
+  }
+  frame[length - 1] = 0x100 - sum;
+}
+
+// Feeds the bytes, returns how many frames they completed
+uint8_t feed(const uint8_t* data, uint8_t length){
+  uint8_t frames = 0;
+  for(uint8_t i = 0; i < length; i++){
+    if(parser.feed(data[i])){
+      frames++;
+    }
+  }
+  return frames;
+}
+
+void test_valid_frame(){
+  uint8_t frame[sizeof(FRAME)];
+  memcpy(frame, FRAME, sizeof(frame));
+  seal(frame, sizeof(frame));
+  for(uint8_t i = 0; i < sizeof(frame) - 1; i++){
+    TEST_ASSERT_FALSE(parser.feed(frame[i]));
+  }
+  TEST_ASSERT_TRUE(parser.feed(frame[sizeof(frame) - 1]));
+  TEST_ASSERT_EQUAL_UINT8(2, parser.packetCount());
+  TEST_ASSERT_EQUAL_UINT8(21, parser.packetId(0));
+  TEST_ASSERT_EQUAL_UINT8(2, parser.packetData(0)[0]);
+  const uint8_t* voltage = parser.find(22);
+  TEST_ASSERT_NOT_NULL(voltage);
+  TEST_ASSERT_EQUAL_INT32(16000, decodeSensor(22, voltage));
+  TEST_ASSERT_NULL(parser.find(23));
+  TEST_ASSERT_EQUAL_UINT32(1, parser.stats().frames);
+  TEST_ASSERT_EQUAL_UINT32(0, parser.stats().discarded);
+}
+
+void test_bad_checksum(){
+  uint8_t frames[2 * sizeof(FRAME)];
+  memcpy(frames, FRAME, sizeof(FRAME));
+  memcpy(frames + sizeof(FRAME), FRAME, sizeof(FRAME));
+  seal(frames, sizeof(FRAME));
+  seal(frames + sizeof(FRAME), sizeof(FRAME));
+  frames[3] ^= 1;
+  TEST_ASSERT_EQUAL_UINT8(1, feed(frames, sizeof(frames)));
+  TEST_ASSERT_EQUAL_UINT32(1, parser.stats().checksumErrors);
+  TEST_ASSERT_EQUAL_UINT32(1, parser.stats().frames);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(FRAME), parser.stats().discarded);
+}
+
+// A 19 in the data of a corrupted frame must not cost the next one
+void test_resync_inside_rejected_frame(){
+  parser.expect(PAYLOAD_SIZE);
+  uint8_t frame[sizeof(FRAME)];
+  memcpy(frame, FRAME, sizeof(frame));
+  seal(frame, sizeof(frame));
+  // A header and payload size followed by a frame that starts inside it
+  uint8_t data[3 + sizeof(FRAME)] = { 19, PAYLOAD_SIZE, 19 };
+  memcpy(data + 3, frame, sizeof(frame));
+  TEST_ASSERT_EQUAL_UINT8(1, feed(data, sizeof(data)));
+  TEST_ASSERT_EQUAL_UINT8(22, parser.packetId(1));
+  TEST_ASSERT_TRUE(parser.stats().resyncs > 0);
+  TEST_ASSERT_EQUAL_UINT32(3, parser.stats().discarded);
+}
+
+void test_unexpected_size(){
+  parser.expect(PAYLOAD_SIZE + 1);
+  uint8_t frame[sizeof(FRAME)];
+  memcpy(frame, FRAME, sizeof(frame));
+  seal(frame, sizeof(frame));
+  TEST_ASSERT_EQUAL_UINT8(0, feed(frame, sizeof(frame)));
+  TEST_ASSERT_EQUAL_UINT32(1, parser.stats().malformed);
+}
+
+// Packets that don't fill the payload exactly
+void test_malformed_packets(){
+  uint8_t frame[] = { 19, 4, 21, 2, 22, 0x3e, 0 };
+  seal(frame, sizeof(frame));
+  TEST_ASSERT_EQUAL_UINT8(0, feed(frame, sizeof(frame)));
+  TEST_ASSERT_EQUAL_UINT32(1, parser.stats().malformed);
+}
+
+void test_overrun_drops_frame_in_progress(){
+  uint8_t frame[sizeof(FRAME)];
+  memcpy(frame, FRAME, sizeof(frame));
+  seal(frame, sizeof(frame));
+  feed(frame, 4);
+  parser.overrun();
+  TEST_ASSERT_EQUAL_UINT8(1, feed(frame, sizeof(frame)));
+  TEST_ASSERT_EQUAL_UINT32(1, parser.stats().overruns);
+  TEST_ASSERT_EQUAL_UINT32(4, parser.stats().discarded);
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_valid_frame);
+  RUN_TEST(test_bad_checksum);
+  RUN_TEST(test_resync_inside_rejected_frame);
+  RUN_TEST(test_unexpected_size);
+  RUN_TEST(test_malformed_packets);
+  RUN_TEST(test_overrun_drops_frame_in_progress);
+  return UNITY_END();
+}
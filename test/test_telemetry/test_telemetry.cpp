@@ -0,0 +1,118 @@
+#include <unity.h>
+#include "telemetry.h"
+
+TelemetrySample sample = { 2, 74, 2700, 1999, 15556, -184, 651, -1 };
+
+void setUp(){
+}
+
+void tearDown(){
+}
+
+void test_frame_layout(){
+  uint8_t frame[TELEMETRY_FRAME_SIZE];
+  const uint8_t expected[TELEMETRY_FRAME_SIZE] = {
+    TELEMETRY_FRAME_VERSION, 2, 74, 0x8c, 0x0a, 0xcf, 0x07, 0xc4, 0x3c, 0x48, 0xff, 0x8b, 0x02, 0xff, 0xff
+  };
+  TEST_ASSERT_EQUAL(TELEMETRY_FRAME_SIZE, encodeTelemetryFrame(sample, frame));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, frame, sizeof(expected));
+}
+
+void test_frame_round_trip(){
+  uint8_t frame[TELEMETRY_FRAME_SIZE];
+  encodeTelemetryFrame(sample, frame);
+  TelemetrySample decoded;
+  TEST_ASSERT_TRUE(decodeTelemetryFrame(frame, sizeof(frame), decoded));
+  TEST_ASSERT_EQUAL_UINT8(sample.chargingState, decoded.chargingState);
+  TEST_ASSERT_EQUAL_UINT8(sample.percentage, decoded.percentage);
+  TEST_ASSERT_EQUAL_UINT16(sample.capacity, decoded.capacity);
+  TEST_ASSERT_EQUAL_UINT16(sample.charge, decoded.charge);
+  TEST_ASSERT_EQUAL_UINT16(sample.voltage, decoded.voltage);
+  TEST_ASSERT_EQUAL_INT16(sample.current, decoded.current);
+  TEST_ASSERT_EQUAL_INT16(sample.minutesToEmpty, decoded.minutesToEmpty);
+  TEST_ASSERT_EQUAL_INT16(sample.minutesToFull, decoded.minutesToFull);
+}
+
+// Frames of version 1 have no times, later versions may append fields
+void test_frame_versions(){
+  uint8_t frame[TELEMETRY_FRAME_SIZE + 2];
+  encodeTelemetryFrame(sample, frame);
+  TelemetrySample decoded;
+  TEST_ASSERT_TRUE(decodeTelemetryFrame(frame, sizeof(frame), decoded));
+  TEST_ASSERT_FALSE(decodeTelemetryFrame(frame, TELEMETRY_FRAME_SIZE - 1, decoded));
+
+  frame[0] = 1;
+  TEST_ASSERT_TRUE(decodeTelemetryFrame(frame, TELEMETRY_FRAME_V1_SIZE, decoded));
+  TEST_ASSERT_EQUAL_INT16(-184, decoded.current);
+  TEST_ASSERT_EQUAL_INT16(-1, decoded.minutesToEmpty);
+  TEST_ASSERT_EQUAL_INT16(-1, decoded.minutesToFull);
+  TEST_ASSERT_FALSE(decodeTelemetryFrame(frame, TELEMETRY_FRAME_V1_SIZE - 1, decoded));
+
+  frame[0] = 0;
+  TEST_ASSERT_FALSE(decodeTelemetryFrame(frame, sizeof(frame), decoded));
+  frame[0] = TELEMETRY_FRAME_VERSION + 1;
+  TEST_ASSERT_FALSE(decodeTelemetryFrame(frame, sizeof(frame), decoded));
+  TEST_ASSERT_FALSE(decodeTelemetryFrame(frame, 0, decoded));
+}
+
+void test_record(){
+  TimedSample timed = { 1700000000, sample };
+  uint8_t record[TELEMETRY_RECORD_SIZE];
+  TEST_ASSERT_EQUAL(TELEMETRY_RECORD_SIZE, encodeTelemetryRecord(timed, record));
+  const uint8_t time[] = { 0x00, 0xf1, 0x53, 0x65 };
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(time, record, sizeof(time));
+  TEST_ASSERT_EQUAL_UINT8(TELEMETRY_FRAME_VERSION, record[4]);
+}
+
+// Full, the oldest samples are overwritten
+void test_sample_ring(){
+  TimedSample buffer[3];
+  SampleRing ring(buffer, 3);
+  for(uint32_t time = 1; time <= 5; time++){
+    ring.push(time, sample);
+  }
+  TEST_ASSERT_EQUAL_UINT16(3, ring.size());
+  TEST_ASSERT_EQUAL_UINT32(2, ring.overwritten());
+  TEST_ASSERT_EQUAL_UINT32(3, ring.at(0).time);
+  TEST_ASSERT_EQUAL_UINT32(5, ring.at(2).time);
+  ring.drop(2);
+  TEST_ASSERT_EQUAL_UINT16(1, ring.size());
+  TEST_ASSERT_EQUAL_UINT32(5, ring.at(0).time);
+}
+
+void test_range_stats(){
+  RangeStats stats;
+  TEST_ASSERT_EQUAL_INT32(0, stats.mean());
+  stats.add(-184);
+  stats.add(-100);
+  stats.add(-101);
+  TEST_ASSERT_EQUAL_UINT32(3, stats.count());
+  TEST_ASSERT_EQUAL_INT32(-184, stats.min());
+  TEST_ASSERT_EQUAL_INT32(-100, stats.max());
+  TEST_ASSERT_EQUAL_INT32(-128, stats.mean());
+  stats.reset();
+  TEST_ASSERT_EQUAL_UINT32(0, stats.count());
+}
+
+void test_metric_filter(){
+  MetricFilter filter(10, 1000);
+  TEST_ASSERT_TRUE(filter.shouldPublish(100, 0));
+  filter.published(100, 0);
+  TEST_ASSERT_FALSE(filter.shouldPublish(110, 500));
+  TEST_ASSERT_TRUE(filter.shouldPublish(111, 500));
+  TEST_ASSERT_TRUE(filter.shouldPublish(100, 1000));
+  filter.invalidate();
+  TEST_ASSERT_TRUE(filter.shouldPublish(100, 10));
+}
+
+int main(int argc, char** argv){
+  UNITY_BEGIN();
+  RUN_TEST(test_frame_layout);
+  RUN_TEST(test_frame_round_trip);
+  RUN_TEST(test_frame_versions);
+  RUN_TEST(test_record);
+  RUN_TEST(test_sample_ring);
+  RUN_TEST(test_range_stats);
+  RUN_TEST(test_metric_filter);
+  return UNITY_END();
+}